@@ -0,0 +1,27 @@
+#.rst:
+# EmbedShaders
+# ------------
+# Writes the GLSL shaders of the add-on into a C++ include, run with cmake -P
+#
+# Takes the following variables::
+#
+# SHADER_DIR - the resources/shaders directory of the add-on
+# OUTPUT - the include to write, one { "path", "source" } line per shader
+#
+# Every path is relative to the add-on directory, e.g. "resources/shaders/GL/vert.glsl", the
+# source being a raw string literal. See CGLProgram in src/GLProgram.h.
+
+file(GLOB_RECURSE SHADERS RELATIVE ${SHADER_DIR} ${SHADER_DIR}/*.glsl)
+list(SORT SHADERS)
+
+set(CONTENT "// Generated by EmbedShaders.cmake from ${SHADER_DIR}, do not edit\n")
+foreach(SHADER ${SHADERS})
+  file(READ ${SHADER_DIR}/${SHADER} SOURCE)
+  string(FIND "${SOURCE}" ")glsl\"" DELIMITER)
+  if(NOT DELIMITER EQUAL -1)
+    message(FATAL_ERROR "${SHADER}: contains the raw string delimiter )glsl\"")
+  endif()
+  set(CONTENT "${CONTENT}{ \"resources/shaders/${SHADER}\", R\"glsl(${SOURCE})glsl\" },\n")
+endforeach()
+
+file(WRITE ${OUTPUT} "${CONTENT}")
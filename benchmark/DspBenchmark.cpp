@@ -0,0 +1,361 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+/*
+ * Microbenchmark of the GL-free spectrum processing.
+ *
+ * Times what AudioData() does per call (built-in FFT, band kernel, history push and hand-over to
+ * the render thread) for every FFT length, band count and history depth of a sweep, once per band
+ * kernel implementation this CPU supports. The results are written as JSON, one object per case,
+ * so runs can be compared by a script.
+ */
+
+#include "BarColors.h"
+#include "SpectrumAnalyzer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+struct Options
+{
+  std::string output;            // JSON file, stdout if empty
+  double minTime = 0.02;         // Seconds spent measuring each case
+  unsigned int samples = 25;     // Timed batches per case, for the percentiles
+  unsigned int minFft = 256;
+  unsigned int maxFft = 16384;
+  bool allIsas = true;           // Every supported kernel, or only the best one
+};
+
+void Usage(const char* name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --output FILE      writes the JSON results to FILE (default: stdout)\n"
+          "  --time MS          time spent measuring each case (default 20)\n"
+          "  --samples N        timed batches per case (default 25)\n"
+          "  --fft MIN:MAX      range of FFT lengths, powers of two (default 256:16384)\n"
+          "  --best-isa         only times the kernel the add-on would pick\n",
+          name);
+}
+
+bool IsPowerOfTwo(unsigned int value)
+{
+  return value != 0 && (value & (value - 1)) == 0;
+}
+
+bool ParseOptions(int argc, char** argv, Options& options)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+    if (arg == "--best-isa")
+      options.allIsas = false;
+    else if (value == nullptr)
+      return false;
+    else
+    {
+      i++;
+      if (arg == "--output")
+        options.output = value;
+      else if (arg == "--time")
+        options.minTime = atof(value) / 1000.0;
+      else if (arg == "--samples")
+        options.samples = atoi(value);
+      else if (arg == "--fft")
+      {
+        if (sscanf(value, "%u:%u", &options.minFft, &options.maxFft) != 2)
+          return false;
+      }
+      else
+        return false;
+    }
+  }
+  return options.minTime > 0.0 && options.samples > 0 && IsPowerOfTwo(options.minFft) &&
+         IsPowerOfTwo(options.maxFft) && options.minFft >= CRealFFT::MIN_SIZE && options.minFft <= options.maxFft;
+}
+
+/**
+ * Magnitude spectra with a falling slope, a few peaks and some noise, like music.
+ */
+std::vector<float> MakeFrames(unsigned int bins, unsigned int count)
+{
+  std::vector<float> frames(bins * count);
+  uint32_t noise = 12345;
+  for (unsigned int frame = 0; frame < count; frame++)
+  {
+    for (unsigned int i = 0; i < bins; i++)
+    {
+      noise = noise * 1664525u + 1013904223u;
+      const float random = static_cast<float>(noise >> 8) / (1 << 24);
+      float value = 0.2f * random / (1.0f + 0.05f * i * 512.0f / bins);
+      if ((i * 7 + frame * 3) % (bins / 8 + 1) == 0)
+        value += 0.8f;
+      frames[frame * bins + i] = value;
+    }
+  }
+  return frames;
+}
+
+struct Timing
+{
+  unsigned int calls = 0; // Per batch
+  double mean = 0.0;      // Nanoseconds per call
+  double p50 = 0.0;
+  double p99 = 0.0;
+  double min = 0.0;
+};
+
+/**
+ * Calls "step" in batches sized so that all of them take about minTime, then reports the time per
+ * call of each batch.
+ */
+template<typename Step>
+Timing Measure(const Options& options, Step step)
+{
+  typedef std::chrono::steady_clock Clock;
+
+  // Warms up the caches and finds how many calls a batch needs
+  unsigned int calls = 1;
+  for (;;)
+  {
+    const Clock::time_point start = Clock::now();
+    for (unsigned int i = 0; i < calls; i++)
+      step();
+    const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    if (elapsed * options.samples >= options.minTime || calls >= (1U << 24))
+      break;
+    calls *= 2;
+  }
+
+  std::vector<double> times(options.samples);
+  double total = 0.0;
+  for (double& time : times)
+  {
+    const Clock::time_point start = Clock::now();
+    for (unsigned int i = 0; i < calls; i++)
+      step();
+    time = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / calls;
+    total += time;
+  }
+  std::sort(times.begin(), times.end());
+
+  Timing timing;
+  timing.calls = calls;
+  timing.mean = total / times.size();
+  timing.p50 = times[(times.size() - 1) / 2];
+  timing.p99 = times[std::min(times.size() - 1, static_cast<size_t>(ceil(times.size() * 0.99)) - 1)];
+  timing.min = times.front();
+  return timing;
+}
+
+class CJsonWriter
+{
+public:
+  explicit CJsonWriter(FILE* stream) : m_stream(stream) {}
+
+  void BeginResult(const char* stage)
+  {
+    fprintf(m_stream, "%s\n    {\"stage\": \"%s\"", m_results++ ? "," : "", stage);
+  }
+
+  void Field(const char* name, const char* value) { fprintf(m_stream, ", \"%s\": \"%s\"", name, value); }
+  void Field(const char* name, unsigned int value) { fprintf(m_stream, ", \"%s\": %u", name, value); }
+
+  void EndResult(const Timing& timing)
+  {
+    fprintf(m_stream,
+            ", \"calls_per_batch\": %u, \"mean_ns\": %.1f, \"p50_ns\": %.1f, \"p99_ns\": %.1f, \"min_ns\": %.1f}",
+            timing.calls, timing.mean, timing.p50, timing.p99, timing.min);
+  }
+
+private:
+  FILE* m_stream;
+  unsigned int m_results = 0;
+};
+
+} /* namespace */
+
+int main(int argc, char** argv)
+{
+  Options options;
+  if (!ParseOptions(argc, argv, options))
+  {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  FILE* stream = options.output.empty() ? stdout : fopen(options.output.c_str(), "w");
+  if (!stream)
+  {
+    fprintf(stderr, "Cannot write %s\n", options.output.c_str());
+    return 1;
+  }
+
+  const unsigned int bandCounts[] = {16, 64, 256, 512};
+  const unsigned int depths[] = {16, 128, 512};
+  const unsigned int FRAMES = 16;
+
+  std::vector<CBandKernel::Isa> isas;
+  for (CBandKernel::Isa isa : {CBandKernel::Isa::Scalar, CBandKernel::Isa::SSE2, CBandKernel::Isa::AVX2,
+                               CBandKernel::Isa::NEON})
+  {
+    if (CBandKernel::IsSupported(isa) && (options.allIsas || isa == CBandKernel::BestIsa()))
+      isas.push_back(isa);
+  }
+
+  BandKernelParams logParams;
+  logParams.logarithmic = true;
+  logParams.gain = 0.1f;
+  logParams.offset = 0.8f;
+
+  fprintf(stream, "{\n  \"benchmark\": \"spectrum-dsp\",\n  \"best_isa\": \"%s\",\n  \"results\": [",
+          CBandKernel::IsaName(CBandKernel::BestIsa()));
+  CJsonWriter writer(stream);
+
+  for (unsigned int fft = options.minFft; fft <= options.maxFft; fft *= 2)
+  {
+    const unsigned int bins = fft / 2;
+    const std::vector<float> frames = MakeFrames(bins, FRAMES);
+
+    // The built-in FFT alone
+    {
+      CRealFFT transform;
+      transform.Configure(fft);
+      std::vector<float> input(fft);
+      for (unsigned int i = 0; i < fft; i++)
+        input[i] = frames[i % bins] - 0.5f;
+      std::vector<float> magnitudes(bins);
+      const Timing timing = Measure(options, [&]() { transform.Magnitudes(input.data(), magnitudes.data(), 1.0f); });
+
+      writer.BeginResult("real_fft");
+      writer.Field("fft_size", fft);
+      writer.EndResult(timing);
+    }
+
+    // A whole AudioData() call with the built-in FFT: one block of 1024 stereo samples, which
+    // completes a number of FFT frames depending on the hop. Mono downmix against one grid per
+    // channel, the stereo grids should cost at most twice as much.
+    for (unsigned int overlap : {50, 75})
+    {
+      for (SpectrumChannels layout : {SpectrumChannels::Mono, SpectrumChannels::LeftRight})
+      {
+        const unsigned int BLOCK = 1024 * 2;
+        std::vector<float> block(BLOCK * FRAMES);
+        for (unsigned int i = 0; i < block.size(); i++)
+          block[i] = frames[i % frames.size()] - 0.5f;
+
+        const unsigned int grids = layout == SpectrumChannels::Mono ? 1 : 2;
+        CSpectrumAnalyzer analyzer;
+        analyzer.Configure(256, 128, CBandMapper::DEFAULT_SAMPLE_RATE, grids);
+        analyzer.ConfigureSignal(fft, SpectrumWindow::Hann, overlap / 100.0f, 2, layout);
+        analyzer.SetKernelParams(logParams);
+        unsigned int frame = 0;
+        const Timing timing = Measure(options, [&]() {
+          analyzer.PushAudio(&block[(frame++ % FRAMES) * BLOCK], BLOCK);
+          analyzer.Snapshots().Update();
+        });
+
+        writer.BeginResult("analyzer_push_audio");
+        writer.Field("isa", CBandKernel::IsaName(analyzer.Kernel().GetIsa()));
+        writer.Field("fft_size", fft);
+        writer.Field("overlap_percent", overlap);
+        writer.Field("grids", grids);
+        writer.Field("bands", 256U);
+        writer.Field("depth", 128U);
+        writer.EndResult(timing);
+      }
+    }
+
+    // The band kernel alone, per implementation and reduction
+    for (unsigned int bands : bandCounts)
+    {
+      CBandMapper mapper;
+      mapper.Configure(bands, bins, CBandMapper::DEFAULT_SAMPLE_RATE);
+      std::vector<float> heights(bands);
+
+      for (CBandKernel::Isa isa : isas)
+      {
+        const CBandKernel kernel(isa);
+        for (BandReduction reduction : {BandReduction::Sum, BandReduction::Max, BandReduction::Rms})
+        {
+          BandKernelParams params = logParams;
+          params.reduction = reduction;
+          unsigned int frame = 0;
+          const Timing timing = Measure(options, [&]() {
+            kernel.Process(mapper, &frames[(frame++ % FRAMES) * bins], heights.data(), params);
+          });
+
+          static const char* const reductionNames[] = {"sum", "max", "rms"};
+          writer.BeginResult("band_kernel");
+          writer.Field("isa", CBandKernel::IsaName(isa));
+          writer.Field("reduction", reductionNames[static_cast<int>(reduction)]);
+          writer.Field("fft_size", fft);
+          writer.Field("bands", bands);
+          writer.EndResult(timing);
+        }
+      }
+    }
+
+    // A whole AudioData() call, then the render thread picking the snapshot up
+    for (unsigned int bands : bandCounts)
+    {
+      for (unsigned int depth : depths)
+      {
+        CSpectrumAnalyzer analyzer;
+        analyzer.Configure(bands, depth, CBandMapper::DEFAULT_SAMPLE_RATE);
+        analyzer.SetKernelParams(logParams);
+        unsigned int frame = 0;
+        const Timing timing = Measure(options, [&]() {
+          analyzer.Push(&frames[(frame % FRAMES) * bins], bins, frame * 0.02);
+          frame++;
+          analyzer.Snapshots().Update();
+        });
+
+        writer.BeginResult("analyzer_push");
+        writer.Field("isa", CBandKernel::IsaName(analyzer.Kernel().GetIsa()));
+        writer.Field("fft_size", fft);
+        writer.Field("bands", bands);
+        writer.Field("depth", depth);
+        writer.EndResult(timing);
+      }
+    }
+  }
+
+  // Bar palette, as rebuilt when the color setting changes, whatever the grid size
+  for (int scheme : {BAR_COLOR_GRADIENT, BAR_COLOR_SOLID, BAR_COLOR_TWO_GRADIENT})
+  {
+    uint8_t palette[BAR_PALETTE_SIZE * BAR_PALETTE_SIZE * 4];
+    unsigned int sink = 0;
+    const Timing timing = Measure(options, [&]() {
+      BuildBarPalette(scheme, palette);
+      sink += palette[0];
+    });
+    if (sink == 1)
+      fprintf(stderr, "Unexpected palette\n");
+
+    writer.BeginResult("bar_palette");
+    writer.Field("scheme", scheme);
+    writer.EndResult(timing);
+  }
+
+  fprintf(stream, "\n  ]\n}\n");
+  if (stream != stdout)
+    fclose(stream);
+  return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "KodiStub.h"
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace
+{
+
+std::string g_addonPath = ".";
+std::string g_userPath;
+std::map<std::string, std::string> g_settings;
+AddonLog g_logLevel = ADDON_LOG_INFO;
+
+const char* LevelName(AddonLog level)
+{
+  switch (level)
+  {
+    case ADDON_LOG_DEBUG:
+      return "DEBUG";
+    case ADDON_LOG_INFO:
+      return "INFO";
+    case ADDON_LOG_WARNING:
+      return "WARNING";
+    case ADDON_LOG_ERROR:
+      return "ERROR";
+    default:
+      return "FATAL";
+  }
+}
+
+} // namespace
+
+void CKodiStub::SetAddonPath(const std::string& path)
+{
+  g_addonPath = path;
+}
+
+void CKodiStub::SetUserPath(const std::string& path)
+{
+  g_userPath = path;
+}
+
+bool CKodiStub::LoadSettingDefaults()
+{
+  std::ifstream stream(g_addonPath + "/resources/settings.xml");
+  if (!stream)
+    return false;
+
+  std::stringstream buffer;
+  buffer << stream.rdbuf();
+  const std::string xml = buffer.str();
+
+  // Good enough for our own settings.xml: every <setting id="..."> has its <default> inside
+  size_t position = 0;
+  while ((position = xml.find("<setting id=\"", position)) != std::string::npos)
+  {
+    position += 13;
+    const size_t idEnd = xml.find('"', position);
+    const size_t settingEnd = xml.find("</setting>", idEnd);
+    const size_t defaultBegin = xml.find("<default>", idEnd);
+    if (idEnd == std::string::npos || defaultBegin == std::string::npos || defaultBegin > settingEnd)
+      continue;
+
+    const size_t valueBegin = defaultBegin + 9;
+    const size_t valueEnd = xml.find("</default>", valueBegin);
+    if (valueEnd == std::string::npos)
+      break;
+
+    g_settings.emplace(xml.substr(position, idEnd - position), xml.substr(valueBegin, valueEnd - valueBegin));
+  }
+  return true;
+}
+
+void CKodiStub::SetSetting(const std::string& name, const std::string& value)
+{
+  g_settings[name] = value;
+}
+
+void CKodiStub::SetLogLevel(AddonLog level)
+{
+  g_logLevel = level;
+}
+
+namespace kodi
+{
+
+int GetSettingInt(const std::string& settingName, int defaultValue)
+{
+  auto it = g_settings.find(settingName);
+  return it != g_settings.end() ? atoi(it->second.c_str()) : defaultValue;
+}
+
+bool GetSettingBoolean(const std::string& settingName, bool defaultValue)
+{
+  auto it = g_settings.find(settingName);
+  if (it == g_settings.end())
+    return defaultValue;
+  return it->second == "true" || atoi(it->second.c_str()) != 0;
+}
+
+std::string GetAddonPath(const std::string& append)
+{
+  if (append.empty())
+    return g_addonPath;
+  return g_addonPath + "/" + append;
+}
+
+std::string GetBaseUserPath(const std::string& append)
+{
+  if (append.empty() || g_userPath.empty())
+    return g_userPath;
+  return g_userPath + "/" + append;
+}
+
+void Log(const AddonLog loglevel, const char* format, ...)
+{
+  if (loglevel < g_logLevel)
+    return;
+
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "%s: ", LevelName(loglevel));
+  vfprintf(stderr, format, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+}
+
+} /* namespace kodi */
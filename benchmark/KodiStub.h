@@ -0,0 +1,45 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <kodi/AddonBase.h>
+
+#include <string>
+
+/**
+ * Configuration of the stub Kodi API the benchmark links the add-on against.
+ */
+class CKodiStub
+{
+public:
+  /**
+   * Sets the add-on directory, the one holding resources/, GetAddonPath() is relative to it.
+   */
+  static void SetAddonPath(const std::string& path);
+
+  /**
+   * Sets the add-on profile directory, GetBaseUserPath() is relative to it. Empty by default, the
+   * add-on then keeps nothing on disk.
+   */
+  static void SetUserPath(const std::string& path);
+
+  /**
+   * Reads the default value of every setting from resources/settings.xml of the add-on path.
+   */
+  static bool LoadSettingDefaults();
+
+  /**
+   * Overrides a setting, as if the user had changed it before the add-on was created.
+   */
+  static void SetSetting(const std::string& name, const std::string& value);
+
+  /**
+   * Messages below this level are dropped, ADDON_LOG_INFO by default.
+   */
+  static void SetLogLevel(AddonLog level);
+};
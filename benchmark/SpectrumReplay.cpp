@@ -0,0 +1,487 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+/*
+ * Headless replay benchmark.
+ *
+ * Runs the GL add-on outside of Kodi, against the stub API of KodiStub.cpp, in an offscreen EGL
+ * context (surfaceless, so llvmpipe works on machines without a GPU). A recorded or synthetic
+ * signal is fed through AudioData() and the frames are drawn with Render(), the per-frame CPU
+ * times are reported as percentiles.
+ */
+
+#include "KodiStub.h"
+
+#include <kodi/addon-instance/Visualization.h>
+#include <kodi/gui/gl/GL.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <algorithm>
+#include <chrono>
+#include <complex>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifndef SPECTRUM_ADDON_DIR
+#define SPECTRUM_ADDON_DIR "visualization.spectrum"
+#endif
+
+// Kodi hands over blocks of 1024 samples and half as many FFT bins
+#define AUDIO_BLOCK_SIZE (1024U)
+// The samples are handed over as interleaved stereo, both channels being the same
+#define AUDIO_CHANNELS (2U)
+
+namespace
+{
+
+struct Options
+{
+  std::string addonPath = SPECTRUM_ADDON_DIR;
+  std::string profilePath; // Add-on profile directory, for the shader cache, none if empty
+  std::string input;  // Raw 32-bit float mono PCM, synthetic signal if empty
+  std::string output; // Last frame as a binary PPM, if not empty
+  unsigned int sampleRate = 44100;
+  unsigned int frames = 1000;
+  unsigned int warmup = 60;
+  unsigned int updates = 1; // AudioData() calls per frame
+  unsigned int width = 1280;
+  unsigned int height = 720;
+  bool finish = true;       // glFinish() after each frame, so the GPU work is accounted for
+  bool verbose = false;
+};
+
+void Usage(const char* name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --addon-dir DIR    add-on directory (default %s)\n"
+          "  --profile-dir DIR  add-on profile directory, keeps the shader cache (default: none)\n"
+          "  --input FILE       raw 32-bit float mono PCM to replay (default: synthetic signal)\n"
+          "  --rate HZ          sample rate of the signal (default 44100)\n"
+          "  --frames N         measured frames (default 1000)\n"
+          "  --warmup N         frames rendered before measuring (default 60)\n"
+          "  --updates N        AudioData() calls per frame (default 1)\n"
+          "  --size WxH         framebuffer size (default 1280x720)\n"
+          "  --set NAME=VALUE   overrides an add-on setting, can be repeated\n"
+          "  --no-finish        do not wait for the GPU at the end of each frame\n"
+          "  --output FILE      writes the last frame as a PPM image\n"
+          "  --verbose          shows the add-on debug log\n",
+          name, SPECTRUM_ADDON_DIR);
+}
+
+bool ParseOptions(int argc, char** argv, Options& options)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+    if (arg == "--no-finish")
+      options.finish = false;
+    else if (arg == "--verbose")
+      options.verbose = true;
+    else if (value == nullptr)
+      return false;
+    else
+    {
+      i++;
+      if (arg == "--addon-dir")
+        options.addonPath = value;
+      else if (arg == "--profile-dir")
+        options.profilePath = value;
+      else if (arg == "--input")
+        options.input = value;
+      else if (arg == "--output")
+        options.output = value;
+      else if (arg == "--rate")
+        options.sampleRate = atoi(value);
+      else if (arg == "--frames")
+        options.frames = atoi(value);
+      else if (arg == "--warmup")
+        options.warmup = atoi(value);
+      else if (arg == "--updates")
+        options.updates = atoi(value);
+      else if (arg == "--size")
+      {
+        if (sscanf(value, "%ux%u", &options.width, &options.height) != 2)
+          return false;
+      }
+      else if (arg == "--set")
+      {
+        const char* equal = strchr(value, '=');
+        if (equal == nullptr)
+          return false;
+        CKodiStub::SetSetting(std::string(value, equal - value), equal + 1);
+      }
+      else
+        return false;
+    }
+  }
+  return options.frames > 0 && options.sampleRate > 0 && options.width > 0 && options.height > 0;
+}
+
+/**
+ * Audio blocks and their spectrum, from a file or generated.
+ */
+class CSignal
+{
+public:
+  bool Open(const Options& options)
+  {
+    m_sampleRate = options.sampleRate;
+    if (options.input.empty())
+      return true;
+
+    FILE* file = fopen(options.input.c_str(), "rb");
+    if (!file)
+      return false;
+
+    float buffer[4096];
+    size_t count;
+    while ((count = fread(buffer, sizeof(float), 4096, file)) > 0)
+      m_recording.insert(m_recording.end(), buffer, buffer + count);
+    fclose(file);
+    return m_recording.size() >= AUDIO_BLOCK_SIZE;
+  }
+
+  /**
+   * Fills the next block of samples and its magnitude spectrum (AUDIO_BLOCK_SIZE / 2 bins).
+   */
+  void Next(float* samples, float* freqData)
+  {
+    for (unsigned int i = 0; i < AUDIO_BLOCK_SIZE; i++)
+      samples[i] = m_recording.empty() ? Synthesize() : m_recording[(m_position++) % m_recording.size()];
+
+    // Hann windowed magnitude spectrum, scaled so a full scale sine peaks around 1
+    std::complex<float> bins[AUDIO_BLOCK_SIZE];
+    for (unsigned int i = 0; i < AUDIO_BLOCK_SIZE; i++)
+      bins[i] = samples[i] * (0.5f - 0.5f * cosf(2.0f * static_cast<float>(M_PI) * i / AUDIO_BLOCK_SIZE));
+    Transform(bins);
+    for (unsigned int i = 0; i < AUDIO_BLOCK_SIZE / 2; i++)
+      freqData[i] = std::abs(bins[i]) * 4.0f / AUDIO_BLOCK_SIZE;
+  }
+
+private:
+  /**
+   * A few tones sweeping up and down the audible range over some noise.
+   */
+  float Synthesize()
+  {
+    const double time = static_cast<double>(m_position++) / m_sampleRate;
+    float sample = 0.0f;
+    for (int tone = 0; tone < 3; tone++)
+    {
+      const double sweep = 0.5 + 0.5 * sin(2.0 * M_PI * time / (7.0 + 5.0 * tone));
+      const double frequency = 40.0 * pow(400.0, sweep);
+      m_phase[tone] += 2.0 * M_PI * frequency / m_sampleRate;
+      sample += 0.25f * static_cast<float>(sin(m_phase[tone]));
+    }
+
+    m_noise = m_noise * 1664525u + 1013904223u;
+    return sample + 0.05f * (static_cast<float>(m_noise >> 8) / (1 << 24) - 0.5f);
+  }
+
+  /**
+   * In-place radix-2 FFT of AUDIO_BLOCK_SIZE values.
+   */
+  static void Transform(std::complex<float>* data)
+  {
+    const unsigned int n = AUDIO_BLOCK_SIZE;
+    for (unsigned int i = 1, j = 0; i < n; i++)
+    {
+      unsigned int bit = n >> 1;
+      for (; j & bit; bit >>= 1)
+        j ^= bit;
+      j ^= bit;
+      if (i < j)
+        std::swap(data[i], data[j]);
+    }
+
+    for (unsigned int length = 2; length <= n; length <<= 1)
+    {
+      const float angle = -2.0f * static_cast<float>(M_PI) / length;
+      const std::complex<float> step(cosf(angle), sinf(angle));
+      for (unsigned int start = 0; start < n; start += length)
+      {
+        std::complex<float> twiddle(1.0f, 0.0f);
+        for (unsigned int k = 0; k < length / 2; k++)
+        {
+          const std::complex<float> odd = data[start + k + length / 2] * twiddle;
+          data[start + k + length / 2] = data[start + k] - odd;
+          data[start + k] += odd;
+          twiddle *= step;
+        }
+      }
+    }
+  }
+
+  std::vector<float> m_recording;
+  unsigned int m_sampleRate = 44100;
+  size_t m_position = 0;
+  double m_phase[3] = {0.0, 0.0, 0.0};
+  uint32_t m_noise = 1;
+};
+
+/**
+ * Offscreen rendering target: surfaceless EGL context and a framebuffer object.
+ */
+class COffscreenContext
+{
+public:
+  ~COffscreenContext()
+  {
+    if (m_display == EGL_NO_DISPLAY)
+      return;
+
+    if (m_framebuffer)
+    {
+      glDeleteRenderbuffers(2, m_renderbuffers);
+      glDeleteFramebuffers(1, &m_framebuffer);
+    }
+#if defined(HAS_GL)
+    if (m_vao)
+      glDeleteVertexArrays(1, &m_vao);
+#endif
+    eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (m_context != EGL_NO_CONTEXT)
+      eglDestroyContext(m_display, m_context);
+    eglTerminate(m_display);
+  }
+
+  bool Create(unsigned int width, unsigned int height)
+  {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if (getPlatformDisplay)
+      m_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (m_display == EGL_NO_DISPLAY)
+      m_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, &major, &minor))
+    {
+      fprintf(stderr, "No EGL display\n");
+      return false;
+    }
+
+#if defined(HAS_GL)
+    eglBindAPI(EGL_OPENGL_API);
+    const EGLint attributes[] = {EGL_CONTEXT_MAJOR_VERSION, 3,
+                                 EGL_CONTEXT_MINOR_VERSION, 2,
+                                 EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                                 EGL_NONE};
+#else
+    eglBindAPI(EGL_OPENGL_ES_API);
+    const EGLint attributes[] = {EGL_CONTEXT_MAJOR_VERSION, HAS_GLES, EGL_NONE};
+#endif
+    m_context = eglCreateContext(m_display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+    if (m_context == EGL_NO_CONTEXT || !eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_context))
+    {
+      fprintf(stderr, "Failed to create a surfaceless EGL context (EGL_KHR_surfaceless_context needed)\n");
+      return false;
+    }
+
+#if defined(HAS_GLES) && (HAS_GLES == 2)
+    const GLenum colorFormat = GL_RGBA4;
+#else
+    const GLenum colorFormat = GL_RGBA8;
+#endif
+    glGenFramebuffers(1, &m_framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glGenRenderbuffers(2, m_renderbuffers);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_renderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, colorFormat, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_renderbuffers[0]);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_renderbuffers[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_renderbuffers[1]);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+      fprintf(stderr, "Incomplete framebuffer\n");
+      return false;
+    }
+    glViewport(0, 0, width, height);
+
+#if defined(HAS_GL)
+    // Kodi renders with a core profile and keeps a vertex array object bound
+    glGenVertexArrays(1, &m_vao);
+    glBindVertexArray(m_vao);
+#endif
+
+    m_width = width;
+    m_height = height;
+    printf("Renderer: %s, %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+    return true;
+  }
+
+  bool SavePPM(const std::string& file) const
+  {
+    std::vector<unsigned char> pixels(m_width * m_height * 4);
+    glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+
+    FILE* stream = fopen(file.c_str(), "wb");
+    if (!stream)
+      return false;
+    fprintf(stream, "P6 %u %u 255\n", m_width, m_height);
+    for (unsigned int y = m_height; y > 0; y--)
+    {
+      for (unsigned int x = 0; x < m_width; x++)
+        fwrite(&pixels[((y - 1) * m_width + x) * 4], 1, 3, stream);
+    }
+    fclose(stream);
+    return true;
+  }
+
+private:
+  EGLDisplay m_display = EGL_NO_DISPLAY;
+  EGLContext m_context = EGL_NO_CONTEXT;
+  GLuint m_framebuffer = 0;
+  GLuint m_renderbuffers[2] = {0, 0};
+  GLuint m_vao = 0;
+  unsigned int m_width = 0;
+  unsigned int m_height = 0;
+};
+
+/**
+ * Prints the percentiles of a series of durations, in milliseconds.
+ */
+void Report(const char* name, std::vector<double> times)
+{
+  if (times.empty())
+    return;
+
+  std::sort(times.begin(), times.end());
+  auto percentile = [&times](double p) {
+    size_t rank = static_cast<size_t>(p / 100.0 * times.size() + 0.5);
+    return times[std::min(std::max<size_t>(rank, 1), times.size()) - 1];
+  };
+
+  double total = 0.0;
+  for (double time : times)
+    total += time;
+
+  printf("%-10s mean %8.3f  p50 %8.3f  p90 %8.3f  p95 %8.3f  p99 %8.3f  max %8.3f ms\n", name,
+         total / times.size(), percentile(50.0), percentile(90.0), percentile(95.0), percentile(99.0),
+         times.back());
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  Options options;
+  if (!ParseOptions(argc, argv, options))
+  {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  CKodiStub::SetAddonPath(options.addonPath);
+  CKodiStub::SetUserPath(options.profilePath);
+  CKodiStub::SetLogLevel(options.verbose ? ADDON_LOG_DEBUG : ADDON_LOG_INFO);
+  if (!CKodiStub::LoadSettingDefaults())
+  {
+    fprintf(stderr, "No settings.xml in %s/resources, see --addon-dir\n", options.addonPath.c_str());
+    return 1;
+  }
+
+  CSignal signal;
+  if (!signal.Open(options))
+  {
+    fprintf(stderr, "Cannot read %s\n", options.input.c_str());
+    return 1;
+  }
+
+  COffscreenContext context;
+  if (!context.Create(options.width, options.height))
+    return 1;
+
+  kodi::addon::CAddonBase* addon = CreateAddon();
+  kodi::addon::CInstanceVisualization* visualization = dynamic_cast<kodi::addon::CInstanceVisualization*>(addon);
+  if (!visualization || !visualization->Start(AUDIO_CHANNELS, options.sampleRate, 16, "replay"))
+  {
+    fprintf(stderr, "Failed to start the add-on\n");
+    delete addon;
+    return 1;
+  }
+
+  bool wantsFreq;
+  int syncDelay;
+  visualization->GetInfo(wantsFreq, syncDelay);
+
+  std::vector<float> samples(AUDIO_BLOCK_SIZE);
+  std::vector<float> interleaved(AUDIO_BLOCK_SIZE * AUDIO_CHANNELS);
+  std::vector<float> freqData(AUDIO_BLOCK_SIZE / 2);
+  std::vector<double> audioTimes, renderTimes, frameTimes;
+  audioTimes.reserve(options.frames * options.updates);
+  renderTimes.reserve(options.frames);
+  frameTimes.reserve(options.frames);
+
+  typedef std::chrono::steady_clock Clock;
+  const Clock::time_point start = Clock::now();
+  Clock::time_point measureStart = start;
+
+  for (unsigned int frame = 0; frame < options.warmup + options.frames; frame++)
+  {
+    const bool measured = frame >= options.warmup;
+    if (frame == options.warmup)
+      measureStart = Clock::now();
+
+    const Clock::time_point frameStart = Clock::now();
+    for (unsigned int update = 0; update < options.updates; update++)
+    {
+      signal.Next(samples.data(), freqData.data());
+      for (unsigned int i = 0; i < AUDIO_BLOCK_SIZE * AUDIO_CHANNELS; i++)
+        interleaved[i] = samples[i / AUDIO_CHANNELS];
+      const Clock::time_point audioStart = Clock::now();
+      visualization->AudioData(interleaved.data(), AUDIO_BLOCK_SIZE * AUDIO_CHANNELS, wantsFreq ? freqData.data() : nullptr,
+                               wantsFreq ? AUDIO_BLOCK_SIZE / 2 : 0);
+      if (measured)
+        audioTimes.push_back(std::chrono::duration<double, std::milli>(Clock::now() - audioStart).count());
+    }
+
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    const Clock::time_point renderStart = Clock::now();
+    visualization->Render();
+    if (options.finish)
+      glFinish();
+    const Clock::time_point renderEnd = Clock::now();
+
+    if (measured)
+    {
+      renderTimes.push_back(std::chrono::duration<double, std::milli>(renderEnd - renderStart).count());
+      frameTimes.push_back(std::chrono::duration<double, std::milli>(renderEnd - frameStart).count());
+    }
+  }
+
+  const double elapsed = std::chrono::duration<double>(Clock::now() - measureStart).count();
+  const GLenum error = glGetError();
+  if (error != GL_NO_ERROR)
+    fprintf(stderr, "GL error 0x%x\n", error);
+
+  printf("%u frames at %ux%u, %u AudioData() per frame, %s\n", options.frames, options.width, options.height,
+         options.updates, options.finish ? "glFinish() per frame" : "no glFinish()");
+  Report("AudioData", audioTimes);
+  Report("Render", renderTimes);
+  Report("Frame", frameTimes);
+  printf("Throughput %.1f frames/s\n", options.frames / elapsed);
+
+  if (!options.output.empty() && !context.SavePPM(options.output))
+    fprintf(stderr, "Cannot write %s\n", options.output.c_str());
+
+  visualization->Stop();
+  delete addon;
+  return error == GL_NO_ERROR ? 0 : 1;
+}
@@ -0,0 +1,87 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+// Minimal stand-in for the Kodi add-on API, just what the spectrum add-on uses. Only for the
+// headless benchmark, the add-on itself is always built against the real headers.
+
+#include <string>
+
+#define ATTRIBUTE_HIDDEN
+#define ATTRIBUTE_FORCEINLINE inline
+
+typedef enum ADDON_STATUS
+{
+  ADDON_STATUS_OK,
+  ADDON_STATUS_LOST_CONNECTION,
+  ADDON_STATUS_NEED_RESTART,
+  ADDON_STATUS_NEED_SETTINGS,
+  ADDON_STATUS_UNKNOWN,
+  ADDON_STATUS_PERMANENT_FAILURE,
+  ADDON_STATUS_NOT_IMPLEMENTED
+} ADDON_STATUS;
+
+typedef enum AddonLog
+{
+  ADDON_LOG_DEBUG = 0,
+  ADDON_LOG_INFO = 1,
+  ADDON_LOG_WARNING = 2,
+  ADDON_LOG_ERROR = 3,
+  ADDON_LOG_FATAL = 4
+} AddonLog;
+
+namespace kodi
+{
+
+class CSettingValue
+{
+public:
+  explicit CSettingValue(const std::string& value) : m_value(value) {}
+
+  bool empty() const { return m_value.empty(); }
+  std::string GetString() const { return m_value; }
+  int GetInt() const { return std::stoi(m_value); }
+  bool GetBoolean() const { return std::stoi(m_value) != 0; }
+  float GetFloat() const { return std::stof(m_value); }
+
+private:
+  std::string m_value;
+};
+
+int GetSettingInt(const std::string& settingName, int defaultValue = 0);
+bool GetSettingBoolean(const std::string& settingName, bool defaultValue = false);
+std::string GetAddonPath(const std::string& append = "");
+std::string GetBaseUserPath(const std::string& append = "");
+void Log(const AddonLog loglevel, const char* format, ...);
+
+namespace addon
+{
+
+class CAddonBase
+{
+public:
+  CAddonBase() = default;
+  virtual ~CAddonBase() = default;
+
+  virtual ADDON_STATUS Create() { return ADDON_STATUS_OK; }
+  virtual ADDON_STATUS SetSetting(const std::string& /*settingName*/, const kodi::CSettingValue& /*settingValue*/)
+  {
+    return ADDON_STATUS_UNKNOWN;
+  }
+};
+
+} /* namespace addon */
+} /* namespace kodi */
+
+/*
+ * The benchmark creates the add-on through this function instead of the Kodi entry points.
+ */
+kodi::addon::CAddonBase* CreateAddon();
+
+#define ADDONCREATOR(AddonClass) \
+  kodi::addon::CAddonBase* CreateAddon() { return new AddonClass; }
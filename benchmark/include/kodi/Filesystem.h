@@ -0,0 +1,107 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+// Minimal stand-in for the Kodi VFS, just what the spectrum add-on uses: local files only.
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+namespace kodi
+{
+namespace vfs
+{
+
+inline bool FileExists(const std::string& filename, bool usecache = false)
+{
+  (void)usecache;
+  struct stat status;
+  return stat(filename.c_str(), &status) == 0 && S_ISREG(status.st_mode);
+}
+
+inline bool DirectoryExists(const std::string& path)
+{
+  struct stat status;
+  return stat(path.c_str(), &status) == 0 && S_ISDIR(status.st_mode);
+}
+
+// Creates the missing parents too, like Kodi does
+inline bool CreateDirectory(const std::string& path)
+{
+  if (path.empty() || DirectoryExists(path))
+    return !path.empty();
+
+  const size_t slash = path.find_last_of('/', path.size() - 2);
+  if (slash != std::string::npos && slash > 0 && !CreateDirectory(path.substr(0, slash)))
+    return false;
+  return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+inline bool DeleteFile(const std::string& filename)
+{
+  return remove(filename.c_str()) == 0;
+}
+
+class CFile
+{
+public:
+  CFile() = default;
+  CFile(const CFile&) = delete;
+  CFile& operator=(const CFile&) = delete;
+  ~CFile() { Close(); }
+
+  bool OpenFile(const std::string& filename, unsigned int flags = 0)
+  {
+    (void)flags;
+    Close();
+    m_file = fopen(filename.c_str(), "rb");
+    return m_file != nullptr;
+  }
+
+  bool OpenFileForWrite(const std::string& filename, bool overwrite = false)
+  {
+    Close();
+    if (!overwrite && FileExists(filename))
+      return false;
+    m_file = fopen(filename.c_str(), "wb");
+    return m_file != nullptr;
+  }
+
+  void Close()
+  {
+    if (m_file)
+      fclose(m_file);
+    m_file = nullptr;
+  }
+
+  ssize_t Read(void* ptr, size_t size)
+  {
+    return m_file ? static_cast<ssize_t>(fread(ptr, 1, size, m_file)) : -1;
+  }
+
+  ssize_t Write(const void* ptr, size_t size)
+  {
+    return m_file ? static_cast<ssize_t>(fwrite(ptr, 1, size, m_file)) : -1;
+  }
+
+  int64_t GetLength() const
+  {
+    struct stat status;
+    return m_file && fstat(fileno(m_file), &status) == 0 ? status.st_size : -1;
+  }
+
+private:
+  FILE* m_file = nullptr;
+};
+
+} /* namespace vfs */
+} /* namespace kodi */
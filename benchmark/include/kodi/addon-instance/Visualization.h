@@ -0,0 +1,41 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include "../AddonBase.h"
+
+namespace kodi
+{
+namespace addon
+{
+
+class CInstanceVisualization
+{
+public:
+  CInstanceVisualization() = default;
+  virtual ~CInstanceVisualization() = default;
+
+  virtual bool Start(int /*channels*/, int /*samplesPerSec*/, int /*bitsPerSample*/, std::string /*songName*/)
+  {
+    return true;
+  }
+  virtual void Stop() {}
+  virtual void AudioData(const float* /*audioData*/, int /*audioDataLength*/, float* /*freqData*/, int /*freqDataLength*/)
+  {
+  }
+  virtual bool IsDirty() { return true; }
+  virtual void Render() {}
+  virtual void GetInfo(bool& wantsFreq, int& syncDelay)
+  {
+    wantsFreq = false;
+    syncDelay = 0;
+  }
+};
+
+} /* namespace addon */
+} /* namespace kodi */
@@ -0,0 +1,23 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#if defined(HAS_GL)
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#define GL_TYPE_STRING "GL"
+#elif defined(HAS_GLES)
+#if (HAS_GLES == 3)
+#include <GLES3/gl3.h>
+#else
+#include <GLES2/gl2.h>
+#endif
+#include <GLES2/gl2ext.h>
+#define GL_TYPE_STRING "GLES"
+#endif
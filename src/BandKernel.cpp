@@ -0,0 +1,221 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "BandKernel.h"
+#include "BandKernelImpl.h"
+
+#include <algorithm>
+#include <math.h>
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <immintrin.h>
+#include <intrin.h>
+#elif defined(SPECTRUM_HAS_NEON) && defined(__arm__) && defined(__linux__) && !defined(__ARM_NEON)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+constexpr float CBandKernel::MAX_LOG2_ERROR;
+constexpr float CBandKernel::MAX_SUM_ERROR;
+
+namespace
+{
+
+#if defined(SPECTRUM_HAS_SSE2) || defined(SPECTRUM_HAS_AVX2)
+#if defined(_MSC_VER)
+bool CpuHasSSE2()
+{
+  int info[4];
+  __cpuid(info, 1);
+  return (info[3] & (1 << 26)) != 0;
+}
+
+bool CpuHasAVX2()
+{
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return false;
+
+  // AVX registers must also be saved by the OS (OSXSAVE, then XCR0 bits 1 and 2)
+  __cpuid(info, 1);
+  if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+    return false;
+  if ((_xgetbv(0) & 0x6) != 0x6)
+    return false;
+
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+}
+#elif defined(__x86_64__)
+bool CpuHasSSE2() { return true; }
+bool CpuHasAVX2() { return __builtin_cpu_supports("avx2"); }
+#elif defined(__i386__)
+bool CpuHasSSE2() { return __builtin_cpu_supports("sse2"); }
+bool CpuHasAVX2() { return __builtin_cpu_supports("avx2"); }
+#endif
+#endif
+
+#if defined(SPECTRUM_HAS_NEON)
+bool CpuHasNEON()
+{
+#if defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+  return true; // Mandatory on AArch64, or required by the whole build
+#elif defined(__linux__)
+  return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#else
+  return false;
+#endif
+}
+#endif
+
+} // namespace
+
+void BandKernelProcessScalar(const CBandMapper::Band* table,
+                             unsigned int bands,
+                             const float* freqData,
+                             float* heights,
+                             const BandKernelParams& params)
+{
+  for (unsigned int i = 0; i < bands; i++)
+  {
+    const CBandMapper::Band& band = table[i];
+    const float first = freqData[band.firstBin];
+    const float last = freqData[band.lastBin];
+    float value;
+
+    switch (params.reduction)
+    {
+      case BandReduction::Max:
+        value = std::max(first, last);
+        for (unsigned int bin = band.firstBin + 1; bin < band.lastBin; bin++)
+          value = std::max(value, freqData[bin]);
+        break;
+
+      case BandReduction::Rms:
+      {
+        // Mean square here, the square root is folded into the height conversion below
+        const float weight = BandKernelWeight(band);
+        double sum = static_cast<double>(first) * first * band.firstWeight;
+        if (band.firstBin != band.lastBin)
+        {
+          for (unsigned int bin = band.firstBin + 1; bin < band.lastBin; bin++)
+            sum += static_cast<double>(freqData[bin]) * freqData[bin];
+          sum += static_cast<double>(last) * last * band.lastWeight;
+        }
+        value = weight > 0.0f ? static_cast<float>(sum / weight) : 0.0f;
+        break;
+      }
+
+      default:
+      {
+        double sum = static_cast<double>(first) * band.firstWeight;
+        if (band.firstBin != band.lastBin)
+        {
+          for (unsigned int bin = band.firstBin + 1; bin < band.lastBin; bin++)
+            sum += freqData[bin];
+          sum += static_cast<double>(last) * band.lastWeight;
+        }
+        value = static_cast<float>(sum);
+        break;
+      }
+    }
+
+    heights[i] = value;
+  }
+
+  const bool rms = params.reduction == BandReduction::Rms;
+  if (params.logarithmic)
+  {
+    const float gain = rms ? 0.5f * params.gain : params.gain;
+    for (unsigned int i = 0; i < bands; i++)
+      heights[i] = std::max(0.0f, gain * log2f(std::max(heights[i], FLT_MIN)) + params.offset);
+  }
+  else
+  {
+    for (unsigned int i = 0; i < bands; i++)
+      heights[i] = params.gain * (rms ? sqrtf(heights[i]) : heights[i]);
+  }
+}
+
+CBandKernel::CBandKernel(Isa isa) : m_isa(Isa::Scalar), m_process(BandKernelProcessScalar)
+{
+  if (!IsSupported(isa))
+    return;
+
+  switch (isa)
+  {
+#if defined(SPECTRUM_HAS_SSE2)
+    case Isa::SSE2:
+      m_process = BandKernelProcessSSE2;
+      break;
+#endif
+#if defined(SPECTRUM_HAS_AVX2)
+    case Isa::AVX2:
+      m_process = BandKernelProcessAVX2;
+      break;
+#endif
+#if defined(SPECTRUM_HAS_NEON)
+    case Isa::NEON:
+      m_process = BandKernelProcessNEON;
+      break;
+#endif
+    default:
+      return;
+  }
+
+  m_isa = isa;
+}
+
+bool CBandKernel::IsSupported(Isa isa)
+{
+  switch (isa)
+  {
+    case Isa::Scalar:
+      return true;
+#if defined(SPECTRUM_HAS_SSE2)
+    case Isa::SSE2:
+      return CpuHasSSE2();
+#endif
+#if defined(SPECTRUM_HAS_AVX2)
+    case Isa::AVX2:
+      return CpuHasAVX2();
+#endif
+#if defined(SPECTRUM_HAS_NEON)
+    case Isa::NEON:
+      return CpuHasNEON();
+#endif
+    default:
+      return false;
+  }
+}
+
+CBandKernel::Isa CBandKernel::BestIsa()
+{
+  static const Isa preferred[] = {Isa::AVX2, Isa::SSE2, Isa::NEON};
+  for (Isa isa : preferred)
+  {
+    if (IsSupported(isa))
+      return isa;
+  }
+  return Isa::Scalar;
+}
+
+const char* CBandKernel::IsaName(Isa isa)
+{
+  switch (isa)
+  {
+    case Isa::SSE2:
+      return "SSE2";
+    case Isa::AVX2:
+      return "AVX2";
+    case Isa::NEON:
+      return "NEON";
+    default:
+      return "scalar";
+  }
+}
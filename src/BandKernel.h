@@ -0,0 +1,102 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include "BandMapper.h"
+
+/**
+ * How the FFT bins of one band are reduced to a single value.
+ */
+enum class BandReduction
+{
+  Sum = 0, // Weighted sum of the bins
+  Max = 1, // Highest bin touching the band
+  Rms = 2  // Root mean square of the bins, weighted
+};
+
+/**
+ * Parameters of CBandKernel::Process(), see there for the formulas.
+ */
+struct BandKernelParams
+{
+  BandReduction reduction = BandReduction::Sum;
+  bool logarithmic = false;
+  float gain = 1.0f;
+  float offset = 0.0f;
+};
+
+/**
+ * Turns one FFT frame into one row of bar heights, in a single call.
+ *
+ * The bins of every band of a CBandMapper table are reduced (sum, max or RMS), then converted to
+ * a height:
+ *  - linear:      height = gain * value
+ *  - logarithmic: height = max(0, gain * log2(value) + offset)
+ * Decibel and natural log scales are both logarithmic ones, with the proper gain and offset.
+ *
+ * The implementation is picked at runtime among the ones built in: AVX2 or SSE2 on x86, NEON on
+ * ARM, and a scalar one everywhere. The scalar implementation is the reference: it sums in double
+ * precision and uses the C library log2f(), the SIMD ones sum in float, in 4 or 8 lanes, and use a
+ * polynomial approximation of log2. Their results stay within MAX_LOG2_ERROR * |gain| of the
+ * reference in logarithmic mode, and within a relative MAX_SUM_ERROR in linear mode, as checked by
+ * tests/BandKernelTest.cpp.
+ */
+class CBandKernel
+{
+public:
+  enum class Isa
+  {
+    Scalar,
+    SSE2,
+    AVX2,
+    NEON
+  };
+
+  // log2 approximation (4e-6) plus the reordered summation of bands up to 16384 bins
+  static constexpr float MAX_LOG2_ERROR = 1.0e-5f;
+  static constexpr float MAX_SUM_ERROR = 1.0e-5f;
+
+  typedef void (*ProcessFunc)(const CBandMapper::Band* table,
+                              unsigned int bands,
+                              const float* freqData,
+                              float* heights,
+                              const BandKernelParams& params);
+
+  /**
+   * Selects the fastest implementation supported by this CPU.
+   */
+  CBandKernel() : CBandKernel(BestIsa()) {}
+
+  /**
+   * Selects a given implementation, falls back to the scalar one if it is not supported.
+   */
+  explicit CBandKernel(Isa isa);
+
+  /**
+   * Computes the height of every band of "mapper" from "freqData".
+   *
+   * @param[in] mapper The band table, configured for the length of freqData.
+   * @param[in] freqData The FFT bins.
+   * @param[out] heights One height per band.
+   * @param[in] params Reduction and height conversion.
+   */
+  void Process(const CBandMapper& mapper, const float* freqData, float* heights, const BandKernelParams& params) const
+  {
+    m_process(mapper.Table().data(), mapper.BandCount(), freqData, heights, params);
+  }
+
+  Isa GetIsa() const { return m_isa; }
+
+  static bool IsSupported(Isa isa);
+  static Isa BestIsa();
+  static const char* IsaName(Isa isa);
+
+private:
+  Isa m_isa;
+  ProcessFunc m_process;
+};
@@ -0,0 +1,167 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "BandKernelImpl.h"
+
+#include <immintrin.h>
+
+// Built with AVX2 but without FMA: some AVX2 capable CPUs of the same era lack it, and mul + add
+// keeps the rounding of the SSE2 path.
+
+static inline float HorizontalSum(__m256 v)
+{
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  return _mm_cvtss_f32(s);
+}
+
+static inline float HorizontalMax(__m256 v)
+{
+  __m128 s = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  s = _mm_max_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_max_ss(s, _mm_shuffle_ps(s, s, 1));
+  return _mm_cvtss_f32(s);
+}
+
+static inline __m256 Log2(__m256 x)
+{
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256i bits = _mm256_castps_si256(x);
+  __m256 exponent =
+      _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+  __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)),
+                                                 _mm256_set1_epi32(0x3f800000)));
+
+  // m in [1, 2), fold the upper part into [sqrt(2) / 2, 1)
+  const __m256 fold = _mm256_cmp_ps(m, _mm256_set1_ps(BAND_KERNEL_SQRT2), _CMP_GT_OQ);
+  m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(0.5f)), fold);
+  exponent = _mm256_add_ps(exponent, _mm256_and_ps(fold, one));
+
+  const __m256 t = _mm256_div_ps(_mm256_sub_ps(m, one), _mm256_add_ps(m, one));
+  const __m256 t2 = _mm256_mul_ps(t, t);
+  __m256 p = _mm256_add_ps(_mm256_set1_ps(BAND_KERNEL_LOG2_C5),
+                           _mm256_mul_ps(t2, _mm256_set1_ps(BAND_KERNEL_LOG2_C7)));
+  p = _mm256_add_ps(_mm256_set1_ps(BAND_KERNEL_LOG2_C3), _mm256_mul_ps(t2, p));
+  p = _mm256_add_ps(_mm256_set1_ps(BAND_KERNEL_LOG2_C1), _mm256_mul_ps(t2, p));
+  return _mm256_add_ps(exponent, _mm256_mul_ps(t, p));
+}
+
+template<BandReduction reduction>
+static void Reduce(const CBandMapper::Band* table, unsigned int bands, const float* freqData, float* heights)
+{
+  for (unsigned int i = 0; i < bands; i++)
+  {
+    const CBandMapper::Band& band = table[i];
+    const float first = freqData[band.firstBin];
+    const float last = freqData[band.lastBin];
+    const float* bin = freqData + band.firstBin + 1;
+    const float* end = freqData + band.lastBin;
+    float value;
+
+    if (reduction == BandReduction::Max)
+    {
+      __m256 acc = _mm256_set1_ps(first > last ? first : last);
+      for (; bin + 8 <= end; bin += 8)
+        acc = _mm256_max_ps(acc, _mm256_loadu_ps(bin));
+      value = HorizontalMax(acc);
+      for (; bin < end; bin++)
+        value = *bin > value ? *bin : value;
+    }
+    else if (reduction == BandReduction::Rms)
+    {
+      __m256 acc = _mm256_setzero_ps();
+      for (; bin + 8 <= end; bin += 8)
+      {
+        const __m256 v = _mm256_loadu_ps(bin);
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(v, v));
+      }
+      value = HorizontalSum(acc);
+      for (; bin < end; bin++)
+        value += *bin * *bin;
+      value += first * first * band.firstWeight;
+      if (band.firstBin != band.lastBin)
+        value += last * last * band.lastWeight;
+
+      const float weight = BandKernelWeight(band);
+      value = weight > 0.0f ? value / weight : 0.0f;
+    }
+    else
+    {
+      __m256 acc = _mm256_setzero_ps();
+      for (; bin + 8 <= end; bin += 8)
+        acc = _mm256_add_ps(acc, _mm256_loadu_ps(bin));
+      value = HorizontalSum(acc);
+      for (; bin < end; bin++)
+        value += *bin;
+      value += first * band.firstWeight;
+      if (band.firstBin != band.lastBin)
+        value += last * band.lastWeight;
+    }
+
+    heights[i] = value;
+  }
+}
+
+void BandKernelProcessAVX2(const CBandMapper::Band* table,
+                           unsigned int bands,
+                           const float* freqData,
+                           float* heights,
+                           const BandKernelParams& params)
+{
+  switch (params.reduction)
+  {
+    case BandReduction::Max:
+      Reduce<BandReduction::Max>(table, bands, freqData, heights);
+      break;
+    case BandReduction::Rms:
+      Reduce<BandReduction::Rms>(table, bands, freqData, heights);
+      break;
+    default:
+      Reduce<BandReduction::Sum>(table, bands, freqData, heights);
+      break;
+  }
+
+  const bool rms = params.reduction == BandReduction::Rms;
+  unsigned int i = 0;
+  if (params.logarithmic)
+  {
+    const float gain = rms ? 0.5f * params.gain : params.gain;
+    const __m256 vGain = _mm256_set1_ps(gain);
+    const __m256 vOffset = _mm256_set1_ps(params.offset);
+    const __m256 vMin = _mm256_set1_ps(FLT_MIN);
+    const __m256 zero = _mm256_setzero_ps();
+    for (; i + 8 <= bands; i += 8)
+    {
+      const __m256 v = Log2(_mm256_max_ps(_mm256_loadu_ps(heights + i), vMin));
+      _mm256_storeu_ps(heights + i, _mm256_max_ps(zero, _mm256_add_ps(_mm256_mul_ps(vGain, v), vOffset)));
+    }
+    for (; i < bands; i++)
+    {
+      const float h = gain * BandKernelFastLog2(heights[i] > FLT_MIN ? heights[i] : FLT_MIN) + params.offset;
+      heights[i] = h > 0.0f ? h : 0.0f;
+    }
+  }
+  else
+  {
+    const __m256 vGain = _mm256_set1_ps(params.gain);
+    for (; i + 8 <= bands; i += 8)
+    {
+      __m256 v = _mm256_loadu_ps(heights + i);
+      if (rms)
+        v = _mm256_sqrt_ps(v);
+      _mm256_storeu_ps(heights + i, _mm256_mul_ps(vGain, v));
+    }
+    for (; i < bands; i++)
+    {
+      float v = heights[i];
+      if (rms)
+        _mm_store_ss(&v, _mm_sqrt_ss(_mm_set_ss(v)));
+      heights[i] = params.gain * v;
+    }
+  }
+}
@@ -0,0 +1,90 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+// Internal to the CBandKernel implementations, every one of them lives in its own translation
+// unit so it can be built with its own instruction set flags. Only static (file local) helpers
+// are defined here, nothing that could be emitted once with AVX2 code and shared with a CPU that
+// lacks it.
+
+#include "BandKernel.h"
+
+#include <float.h>
+#include <stdint.h>
+#include <string.h>
+
+// Coefficients of log2(m) = 2 / ln(2) * atanh(t), t = (m - 1) / (m + 1), for m in
+// [sqrt(2) / 2, sqrt(2)]: |t| < 0.1716, the truncation error after t^7 stays below 1e-7.
+#define BAND_KERNEL_SQRT2 1.41421356f
+#define BAND_KERNEL_LOG2_C1 2.8853900817779268f
+#define BAND_KERNEL_LOG2_C3 0.9617966939259756f
+#define BAND_KERNEL_LOG2_C5 0.5770780163555854f
+#define BAND_KERNEL_LOG2_C7 0.4121985831111324f
+
+/**
+ * Scalar version of the SIMD log2 approximation, for the tails. x must be a normal number > 0.
+ */
+static inline float BandKernelFastLog2(float x)
+{
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  int exponent = static_cast<int>(bits >> 23) - 127;
+  bits = (bits & 0x007fffff) | 0x3f800000;
+  float m;
+  memcpy(&m, &bits, sizeof(m));
+  if (m > BAND_KERNEL_SQRT2)
+  {
+    m *= 0.5f;
+    exponent++;
+  }
+
+  const float t = (m - 1.0f) / (m + 1.0f);
+  const float t2 = t * t;
+  const float p = BAND_KERNEL_LOG2_C5 + t2 * BAND_KERNEL_LOG2_C7;
+  return static_cast<float>(exponent) + t * (BAND_KERNEL_LOG2_C1 + t2 * (BAND_KERNEL_LOG2_C3 + t2 * p));
+}
+
+/**
+ * Total weight of the bins of a band, the RMS divisor.
+ */
+static inline float BandKernelWeight(const CBandMapper::Band& band)
+{
+  if (band.firstBin == band.lastBin)
+    return band.firstWeight;
+  return band.firstWeight + static_cast<float>(band.lastBin - band.firstBin - 1) + band.lastWeight;
+}
+
+void BandKernelProcessScalar(const CBandMapper::Band* table,
+                             unsigned int bands,
+                             const float* freqData,
+                             float* heights,
+                             const BandKernelParams& params);
+
+#if defined(SPECTRUM_HAS_SSE2)
+void BandKernelProcessSSE2(const CBandMapper::Band* table,
+                           unsigned int bands,
+                           const float* freqData,
+                           float* heights,
+                           const BandKernelParams& params);
+#endif
+
+#if defined(SPECTRUM_HAS_AVX2)
+void BandKernelProcessAVX2(const CBandMapper::Band* table,
+                           unsigned int bands,
+                           const float* freqData,
+                           float* heights,
+                           const BandKernelParams& params);
+#endif
+
+#if defined(SPECTRUM_HAS_NEON)
+void BandKernelProcessNEON(const CBandMapper::Band* table,
+                           unsigned int bands,
+                           const float* freqData,
+                           float* heights,
+                           const BandKernelParams& params);
+#endif
@@ -0,0 +1,192 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "BandKernelImpl.h"
+
+#include <arm_neon.h>
+
+static inline float HorizontalSum(float32x4_t v)
+{
+#if defined(__aarch64__) || defined(_M_ARM64)
+  return vaddvq_f32(v);
+#else
+  float32x2_t s = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+  return vget_lane_f32(vpadd_f32(s, s), 0);
+#endif
+}
+
+static inline float HorizontalMax(float32x4_t v)
+{
+#if defined(__aarch64__) || defined(_M_ARM64)
+  return vmaxvq_f32(v);
+#else
+  float32x2_t s = vmax_f32(vget_low_f32(v), vget_high_f32(v));
+  return vget_lane_f32(vpmax_f32(s, s), 0);
+#endif
+}
+
+static inline float32x4_t Divide(float32x4_t a, float32x4_t b)
+{
+#if defined(__aarch64__) || defined(_M_ARM64)
+  return vdivq_f32(a, b);
+#else
+  // No divide on ARMv7 NEON: reciprocal estimate refined by two Newton-Raphson steps
+  float32x4_t r = vrecpeq_f32(b);
+  r = vmulq_f32(vrecpsq_f32(b, r), r);
+  r = vmulq_f32(vrecpsq_f32(b, r), r);
+  return vmulq_f32(a, r);
+#endif
+}
+
+static inline float32x4_t Log2(float32x4_t x)
+{
+  const float32x4_t one = vdupq_n_f32(1.0f);
+  const uint32x4_t bits = vreinterpretq_u32_f32(x);
+  float32x4_t exponent =
+      vcvtq_f32_s32(vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(bits, 23)), vdupq_n_s32(127)));
+  float32x4_t m = vreinterpretq_f32_u32(vorrq_u32(vandq_u32(bits, vdupq_n_u32(0x007fffff)),
+                                                  vdupq_n_u32(0x3f800000)));
+
+  // m in [1, 2), fold the upper part into [sqrt(2) / 2, 1)
+  const uint32x4_t fold = vcgtq_f32(m, vdupq_n_f32(BAND_KERNEL_SQRT2));
+  m = vbslq_f32(fold, vmulq_n_f32(m, 0.5f), m);
+  exponent = vaddq_f32(exponent, vreinterpretq_f32_u32(vandq_u32(fold, vreinterpretq_u32_f32(one))));
+
+  const float32x4_t t = Divide(vsubq_f32(m, one), vaddq_f32(m, one));
+  const float32x4_t t2 = vmulq_f32(t, t);
+  float32x4_t p = vaddq_f32(vdupq_n_f32(BAND_KERNEL_LOG2_C5), vmulq_n_f32(t2, BAND_KERNEL_LOG2_C7));
+  p = vaddq_f32(vdupq_n_f32(BAND_KERNEL_LOG2_C3), vmulq_f32(t2, p));
+  p = vaddq_f32(vdupq_n_f32(BAND_KERNEL_LOG2_C1), vmulq_f32(t2, p));
+  return vaddq_f32(exponent, vmulq_f32(t, p));
+}
+
+static inline float32x4_t SquareRoot(float32x4_t v)
+{
+#if defined(__aarch64__) || defined(_M_ARM64)
+  return vsqrtq_f32(v);
+#else
+  // 1 / sqrt(v) estimate refined by two Newton-Raphson steps, then times v (0 stays 0)
+  const uint32x4_t zero = vceqq_f32(v, vdupq_n_f32(0.0f));
+  float32x4_t r = vrsqrteq_f32(v);
+  r = vmulq_f32(vrsqrtsq_f32(vmulq_f32(v, r), r), r);
+  r = vmulq_f32(vrsqrtsq_f32(vmulq_f32(v, r), r), r);
+  return vbslq_f32(zero, v, vmulq_f32(v, r));
+#endif
+}
+
+template<BandReduction reduction>
+static void Reduce(const CBandMapper::Band* table, unsigned int bands, const float* freqData, float* heights)
+{
+  for (unsigned int i = 0; i < bands; i++)
+  {
+    const CBandMapper::Band& band = table[i];
+    const float first = freqData[band.firstBin];
+    const float last = freqData[band.lastBin];
+    const float* bin = freqData + band.firstBin + 1;
+    const float* end = freqData + band.lastBin;
+    float value;
+
+    if (reduction == BandReduction::Max)
+    {
+      float32x4_t acc = vdupq_n_f32(first > last ? first : last);
+      for (; bin + 4 <= end; bin += 4)
+        acc = vmaxq_f32(acc, vld1q_f32(bin));
+      value = HorizontalMax(acc);
+      for (; bin < end; bin++)
+        value = *bin > value ? *bin : value;
+    }
+    else if (reduction == BandReduction::Rms)
+    {
+      float32x4_t acc = vdupq_n_f32(0.0f);
+      for (; bin + 4 <= end; bin += 4)
+      {
+        const float32x4_t v = vld1q_f32(bin);
+        acc = vaddq_f32(acc, vmulq_f32(v, v));
+      }
+      value = HorizontalSum(acc);
+      for (; bin < end; bin++)
+        value += *bin * *bin;
+      value += first * first * band.firstWeight;
+      if (band.firstBin != band.lastBin)
+        value += last * last * band.lastWeight;
+
+      const float weight = BandKernelWeight(band);
+      value = weight > 0.0f ? value / weight : 0.0f;
+    }
+    else
+    {
+      float32x4_t acc = vdupq_n_f32(0.0f);
+      for (; bin + 4 <= end; bin += 4)
+        acc = vaddq_f32(acc, vld1q_f32(bin));
+      value = HorizontalSum(acc);
+      for (; bin < end; bin++)
+        value += *bin;
+      value += first * band.firstWeight;
+      if (band.firstBin != band.lastBin)
+        value += last * band.lastWeight;
+    }
+
+    heights[i] = value;
+  }
+}
+
+void BandKernelProcessNEON(const CBandMapper::Band* table,
+                           unsigned int bands,
+                           const float* freqData,
+                           float* heights,
+                           const BandKernelParams& params)
+{
+  switch (params.reduction)
+  {
+    case BandReduction::Max:
+      Reduce<BandReduction::Max>(table, bands, freqData, heights);
+      break;
+    case BandReduction::Rms:
+      Reduce<BandReduction::Rms>(table, bands, freqData, heights);
+      break;
+    default:
+      Reduce<BandReduction::Sum>(table, bands, freqData, heights);
+      break;
+  }
+
+  const bool rms = params.reduction == BandReduction::Rms;
+  unsigned int i = 0;
+  if (params.logarithmic)
+  {
+    const float gain = rms ? 0.5f * params.gain : params.gain;
+    const float32x4_t vOffset = vdupq_n_f32(params.offset);
+    const float32x4_t vMin = vdupq_n_f32(FLT_MIN);
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    for (; i + 4 <= bands; i += 4)
+    {
+      const float32x4_t v = Log2(vmaxq_f32(vld1q_f32(heights + i), vMin));
+      vst1q_f32(heights + i, vmaxq_f32(zero, vaddq_f32(vmulq_n_f32(v, gain), vOffset)));
+    }
+    for (; i < bands; i++)
+    {
+      const float h = gain * BandKernelFastLog2(heights[i] > FLT_MIN ? heights[i] : FLT_MIN) + params.offset;
+      heights[i] = h > 0.0f ? h : 0.0f;
+    }
+  }
+  else
+  {
+    for (; i + 4 <= bands; i += 4)
+    {
+      float32x4_t v = vld1q_f32(heights + i);
+      if (rms)
+        v = SquareRoot(v);
+      vst1q_f32(heights + i, vmulq_n_f32(v, params.gain));
+    }
+    for (; i < bands; i++)
+    {
+      float v = heights[i];
+      if (rms)
+        v = vgetq_lane_f32(SquareRoot(vdupq_n_f32(v)), 0);
+      heights[i] = params.gain * v;
+    }
+  }
+}
@@ -0,0 +1,160 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "BandKernelImpl.h"
+
+#include <emmintrin.h>
+
+static inline float HorizontalSum(__m128 v)
+{
+  v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+  return _mm_cvtss_f32(v);
+}
+
+static inline float HorizontalMax(__m128 v)
+{
+  v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+  v = _mm_max_ss(v, _mm_shuffle_ps(v, v, 1));
+  return _mm_cvtss_f32(v);
+}
+
+static inline __m128 Log2(__m128 x)
+{
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128i bits = _mm_castps_si128(x);
+  __m128 exponent = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+  __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)),
+                                           _mm_set1_epi32(0x3f800000)));
+
+  // m in [1, 2), fold the upper part into [sqrt(2) / 2, 1)
+  const __m128 fold = _mm_cmpgt_ps(m, _mm_set1_ps(BAND_KERNEL_SQRT2));
+  m = _mm_sub_ps(m, _mm_and_ps(fold, _mm_mul_ps(m, _mm_set1_ps(0.5f))));
+  exponent = _mm_add_ps(exponent, _mm_and_ps(fold, one));
+
+  const __m128 t = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+  const __m128 t2 = _mm_mul_ps(t, t);
+  __m128 p = _mm_add_ps(_mm_set1_ps(BAND_KERNEL_LOG2_C5), _mm_mul_ps(t2, _mm_set1_ps(BAND_KERNEL_LOG2_C7)));
+  p = _mm_add_ps(_mm_set1_ps(BAND_KERNEL_LOG2_C3), _mm_mul_ps(t2, p));
+  p = _mm_add_ps(_mm_set1_ps(BAND_KERNEL_LOG2_C1), _mm_mul_ps(t2, p));
+  return _mm_add_ps(exponent, _mm_mul_ps(t, p));
+}
+
+template<BandReduction reduction>
+static void Reduce(const CBandMapper::Band* table, unsigned int bands, const float* freqData, float* heights)
+{
+  for (unsigned int i = 0; i < bands; i++)
+  {
+    const CBandMapper::Band& band = table[i];
+    const float first = freqData[band.firstBin];
+    const float last = freqData[band.lastBin];
+    const float* bin = freqData + band.firstBin + 1;
+    const float* end = freqData + band.lastBin;
+    float value;
+
+    if (reduction == BandReduction::Max)
+    {
+      __m128 acc = _mm_set1_ps(first > last ? first : last);
+      for (; bin + 4 <= end; bin += 4)
+        acc = _mm_max_ps(acc, _mm_loadu_ps(bin));
+      value = HorizontalMax(acc);
+      for (; bin < end; bin++)
+        value = *bin > value ? *bin : value;
+    }
+    else if (reduction == BandReduction::Rms)
+    {
+      __m128 acc = _mm_setzero_ps();
+      for (; bin + 4 <= end; bin += 4)
+      {
+        const __m128 v = _mm_loadu_ps(bin);
+        acc = _mm_add_ps(acc, _mm_mul_ps(v, v));
+      }
+      value = HorizontalSum(acc);
+      for (; bin < end; bin++)
+        value += *bin * *bin;
+      value += first * first * band.firstWeight;
+      if (band.firstBin != band.lastBin)
+        value += last * last * band.lastWeight;
+
+      const float weight = BandKernelWeight(band);
+      value = weight > 0.0f ? value / weight : 0.0f;
+    }
+    else
+    {
+      __m128 acc = _mm_setzero_ps();
+      for (; bin + 4 <= end; bin += 4)
+        acc = _mm_add_ps(acc, _mm_loadu_ps(bin));
+      value = HorizontalSum(acc);
+      for (; bin < end; bin++)
+        value += *bin;
+      value += first * band.firstWeight;
+      if (band.firstBin != band.lastBin)
+        value += last * band.lastWeight;
+    }
+
+    heights[i] = value;
+  }
+}
+
+void BandKernelProcessSSE2(const CBandMapper::Band* table,
+                           unsigned int bands,
+                           const float* freqData,
+                           float* heights,
+                           const BandKernelParams& params)
+{
+  switch (params.reduction)
+  {
+    case BandReduction::Max:
+      Reduce<BandReduction::Max>(table, bands, freqData, heights);
+      break;
+    case BandReduction::Rms:
+      Reduce<BandReduction::Rms>(table, bands, freqData, heights);
+      break;
+    default:
+      Reduce<BandReduction::Sum>(table, bands, freqData, heights);
+      break;
+  }
+
+  const bool rms = params.reduction == BandReduction::Rms;
+  unsigned int i = 0;
+  if (params.logarithmic)
+  {
+    const float gain = rms ? 0.5f * params.gain : params.gain;
+    const __m128 vGain = _mm_set1_ps(gain);
+    const __m128 vOffset = _mm_set1_ps(params.offset);
+    const __m128 vMin = _mm_set1_ps(FLT_MIN);
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= bands; i += 4)
+    {
+      const __m128 v = Log2(_mm_max_ps(_mm_loadu_ps(heights + i), vMin));
+      _mm_storeu_ps(heights + i, _mm_max_ps(zero, _mm_add_ps(_mm_mul_ps(vGain, v), vOffset)));
+    }
+    for (; i < bands; i++)
+    {
+      const float h = gain * BandKernelFastLog2(heights[i] > FLT_MIN ? heights[i] : FLT_MIN) + params.offset;
+      heights[i] = h > 0.0f ? h : 0.0f;
+    }
+  }
+  else
+  {
+    const __m128 vGain = _mm_set1_ps(params.gain);
+    for (; i + 4 <= bands; i += 4)
+    {
+      __m128 v = _mm_loadu_ps(heights + i);
+      if (rms)
+        v = _mm_sqrt_ps(v);
+      _mm_storeu_ps(heights + i, _mm_mul_ps(vGain, v));
+    }
+    for (; i < bands; i++)
+    {
+      float v = heights[i];
+      if (rms)
+        _mm_store_ss(&v, _mm_sqrt_ss(_mm_set_ss(v)));
+      heights[i] = params.gain * v;
+    }
+  }
+}
@@ -0,0 +1,59 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "BandMapper.h"
+
+#include <algorithm>
+#include <math.h>
+
+constexpr float CBandMapper::MIN_FREQUENCY;
+constexpr float CBandMapper::MAX_FREQUENCY;
+
+void CBandMapper::Configure(unsigned int bands, unsigned int bins, unsigned int sampleRate)
+{
+  if (sampleRate == 0)
+    sampleRate = DEFAULT_SAMPLE_RATE;
+
+  m_table.resize(bands);
+  m_bins = bins;
+  m_sampleRate = sampleRate;
+  if (bands == 0 || bins == 0)
+    return;
+
+  // Bin "k" is centered on k * binWidth, so it covers [k - 0.5, k + 0.5) bin widths
+  const float nyquist = sampleRate / 2.0f;
+  const float binWidth = nyquist / bins;
+
+  m_highFrequency = std::min(MAX_FREQUENCY, nyquist);
+  m_lowFrequency = std::min(std::max(MIN_FREQUENCY, binWidth), m_highFrequency / 2.0f);
+
+  const float ratio = logf(m_highFrequency / m_lowFrequency);
+  const float lastPosition = static_cast<float>(bins);
+  float low = std::min(m_lowFrequency / binWidth + 0.5f, lastPosition);
+
+  for (unsigned int i = 0; i < bands; i++)
+  {
+    float frequency = m_lowFrequency * expf(ratio * (i + 1) / bands);
+    float high = std::min(std::max(frequency / binWidth + 0.5f, low), lastPosition);
+
+    Band& band = m_table[i];
+    band.firstBin = std::min(static_cast<unsigned int>(low), bins - 1);
+    band.lastBin = std::max(band.firstBin, std::min(static_cast<unsigned int>(ceilf(high)) - 1, bins - 1));
+    if (band.firstBin == band.lastBin)
+    {
+      band.firstWeight = high - low;
+      band.lastWeight = 0.0f;
+    }
+    else
+    {
+      band.firstWeight = (band.firstBin + 1) - low;
+      band.lastWeight = high - band.lastBin;
+    }
+
+    low = high;
+  }
+}
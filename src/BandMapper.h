@@ -0,0 +1,68 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <vector>
+
+/**
+ * Maps the linear FFT bins handed over by Kodi to logarithmically spaced bands.
+ *
+ * The band edges are placed on a log-frequency scale between MIN_FREQUENCY (or one bin width,
+ * whichever is higher) and MAX_FREQUENCY (or the Nyquist frequency, whichever is lower). Since
+ * an edge rarely falls on a bin boundary, the first and last bins of each band are weighted by
+ * the fraction of them that lies inside the band, so narrow low-frequency bands still get their
+ * share of energy and nothing is dropped in between.
+ *
+ * The table is built by Configure(), CBandKernel then does a single linear pass over the bins.
+ */
+class CBandMapper
+{
+public:
+  static constexpr float MIN_FREQUENCY = 20.0f;
+  static constexpr float MAX_FREQUENCY = 20000.0f;
+  static const unsigned int DEFAULT_SAMPLE_RATE = 44100;
+
+  struct Band
+  {
+    unsigned int firstBin; // First bin of the band, weighted by firstWeight
+    unsigned int lastBin;  // Last bin of the band, weighted by lastWeight (bins in between weigh 1)
+    float firstWeight;
+    float lastWeight;
+  };
+
+  /**
+   * Builds the band table. Only allocates when the number of bands grows.
+   *
+   * @param[in] bands Number of output bands.
+   * @param[in] bins Number of FFT bins, spread linearly from 0 Hz to the Nyquist frequency.
+   * @param[in] sampleRate Sample rate of the analysed signal, 0 for DEFAULT_SAMPLE_RATE.
+   */
+  void Configure(unsigned int bands, unsigned int bins, unsigned int sampleRate);
+
+  /**
+   * Tells whether the table was built for this FFT length and sample rate.
+   */
+  bool IsConfiguredFor(unsigned int bins, unsigned int sampleRate) const
+  {
+    return bins == m_bins && (sampleRate ? sampleRate : DEFAULT_SAMPLE_RATE) == m_sampleRate;
+  }
+
+  const std::vector<Band>& Table() const { return m_table; }
+  unsigned int BandCount() const { return static_cast<unsigned int>(m_table.size()); }
+  unsigned int Bins() const { return m_bins; }
+  unsigned int SampleRate() const { return m_sampleRate; }
+  float LowFrequency() const { return m_lowFrequency; }
+  float HighFrequency() const { return m_highFrequency; }
+
+private:
+  std::vector<Band> m_table;
+  unsigned int m_bins = 0;
+  unsigned int m_sampleRate = 0;
+  float m_lowFrequency = 0.0f;
+  float m_highFrequency = 0.0f;
+};
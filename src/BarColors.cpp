@@ -0,0 +1,58 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "BarColors.h"
+
+#include <math.h>
+
+namespace
+{
+
+/* Colors of the corners of a scheme, as { red, green, blue }. */
+struct BarPaletteCorners
+{
+  float newestLow[3];  // Newest row, lowest band
+  float newestHigh[3]; // Newest row, highest band
+  float oldestLow[3];
+  float oldestHigh[3];
+};
+
+/* Indexed by BarColorScheme. */
+const BarPaletteCorners barPalettes[] =
+{
+  // BAR_COLOR_GRADIENT
+  { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 1.0f } },
+  // BAR_COLOR_SOLID
+  { { 1.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f } },
+  // BAR_COLOR_TWO_GRADIENT
+  { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f } }
+};
+
+} // namespace
+
+void BuildBarPalette(int scheme, uint8_t* rgba)
+{
+  if (scheme < 0 || scheme >= static_cast<int>(sizeof(barPalettes) / sizeof(barPalettes[0])))
+    scheme = BAR_COLOR_GRADIENT;
+  const BarPaletteCorners& corners = barPalettes[scheme];
+
+  for (unsigned int y = 0; y < BAR_PALETTE_SIZE; y++)
+  {
+    const float age = static_cast<float>(y) / (BAR_PALETTE_SIZE - 1);
+    for (unsigned int x = 0; x < BAR_PALETTE_SIZE; x++)
+    {
+      const float band = static_cast<float>(x) / (BAR_PALETTE_SIZE - 1);
+      for (unsigned int c = 0; c < 3; c++)
+      {
+        const float newest = corners.newestLow[c] + (corners.newestHigh[c] - corners.newestLow[c]) * band;
+        const float oldest = corners.oldestLow[c] + (corners.oldestHigh[c] - corners.oldestLow[c]) * band;
+        *rgba++ = static_cast<uint8_t>(lroundf((newest + (oldest - newest) * age) * 255.0f));
+      }
+      *rgba++ = 255;
+    }
+  }
+}
@@ -0,0 +1,48 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Color schemes of the "bar_color_type" setting.
+ */
+enum BarColorScheme
+{
+  BAR_COLOR_GRADIENT = 0,     // Red to green along the bands, fading to blue with age
+  BAR_COLOR_SOLID = 1,        // Plain red
+  BAR_COLOR_TWO_GRADIENT = 2  // Red to green along the bands
+};
+
+/* Texels of a bar palette in each direction, see BuildBarPalette(). */
+#define BAR_PALETTE_SIZE (16U)
+
+/**
+ * Fills the palette of a color scheme, sampled with linear filtering by the bar fragment shader.
+ *
+ * The palette is BAR_PALETTE_SIZE x BAR_PALETTE_SIZE RGBA texels, bands along X from the lowest
+ * one, history rows along Y from the newest one. A scheme is just the colors of its 4 corners,
+ * the texels in between are interpolated.
+ *
+ * @param[in] scheme One of BarColorScheme, unknown values fall back to BAR_COLOR_GRADIENT.
+ * @param[out] rgba BAR_PALETTE_SIZE * BAR_PALETTE_SIZE * 4 bytes.
+ */
+void BuildBarPalette(int scheme, uint8_t* rgba);
+
+/**
+ * Palette texture coordinate of a bar.
+ *
+ * @param[in] index Bar index in the X plane (frequency) or in the Y plane (time), 0 being the
+ *                  newest row.
+ * @param[in] count Number of bars in that plane.
+ * @return The coordinate, between the centers of the first and the last texel.
+ */
+inline float BarPaletteCoord(unsigned int index, unsigned int count)
+{
+  return (0.5f + static_cast<float>(index) / count * (BAR_PALETTE_SIZE - 1)) / BAR_PALETTE_SIZE;
+}
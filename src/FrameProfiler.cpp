@@ -0,0 +1,83 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "FrameProfiler.h"
+
+#include <algorithm>
+
+CFrameProfiler::CFrameProfiler() : m_sorted(RING_SIZE)
+{
+  for (Ring& ring : m_rings)
+  {
+    for (std::atomic<float>& value : ring.values)
+      value.store(0.0f, std::memory_order_relaxed);
+  }
+}
+
+void CFrameProfiler::Record(ProfileStage stage, float milliseconds)
+{
+  Ring& ring = m_rings[static_cast<unsigned int>(stage)];
+  const uint32_t written = ring.written.load(std::memory_order_relaxed);
+  ring.values[written & (RING_SIZE - 1)].store(milliseconds, std::memory_order_relaxed);
+  ring.written.store(written + 1, std::memory_order_release);
+}
+
+void CFrameProfiler::CountAllocations(ProfileStage stage, unsigned int count)
+{
+  m_rings[static_cast<unsigned int>(stage)].allocations.fetch_add(count, std::memory_order_relaxed);
+}
+
+bool CFrameProfiler::Summarize(ProfileStage stage, Summary& summary)
+{
+  Ring& ring = m_rings[static_cast<unsigned int>(stage)];
+  const unsigned int samples = std::min(ring.written.load(std::memory_order_acquire), static_cast<uint32_t>(RING_SIZE));
+  if (samples == 0)
+    return false;
+
+  // The writer may overwrite the oldest samples meanwhile, which only mixes in a newer one
+  for (unsigned int i = 0; i < samples; i++)
+    m_sorted[i] = ring.values[i].load(std::memory_order_relaxed);
+
+  // Each percentile only needs the values below it partitioned, from the highest one down
+  const auto percentile = [&](float fraction, unsigned int end) {
+    const unsigned int index = std::min(static_cast<unsigned int>(fraction * samples), samples - 1);
+    std::nth_element(m_sorted.begin(), m_sorted.begin() + index, m_sorted.begin() + end);
+    return index;
+  };
+  const unsigned int p99 = percentile(0.99f, samples);
+  const unsigned int p95 = percentile(0.95f, p99 + 1);
+  const unsigned int p50 = percentile(0.50f, p95 + 1);
+
+  summary.samples = samples;
+  summary.p50 = m_sorted[p50];
+  summary.p95 = m_sorted[p95];
+  summary.p99 = m_sorted[p99];
+  summary.max = *std::max_element(m_sorted.begin() + p99, m_sorted.begin() + samples);
+  summary.allocations = ring.allocations.exchange(0, std::memory_order_relaxed);
+  return true;
+}
+
+const char* CFrameProfiler::StageName(ProfileStage stage)
+{
+  switch (stage)
+  {
+  case ProfileStage::AudioData:
+    return "AudioData";
+  case ProfileStage::Render:
+    return "Render";
+  case ProfileStage::Heights:
+    return "heights";
+  case ProfileStage::Draw:
+    return "draw";
+  case ProfileStage::GpuHeights:
+    return "GPU heights";
+  case ProfileStage::GpuDraw:
+    return "GPU draw";
+  default:
+    return "?";
+  }
+}
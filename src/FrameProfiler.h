@@ -0,0 +1,117 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Timed stages of the hot paths.
+ */
+enum class ProfileStage : unsigned int
+{
+  AudioData = 0, // CPU, audio thread: the whole AudioData() call
+  Render,        // CPU, render thread: the whole Render() call
+  Heights,       // CPU, render thread: history upload and smoothing pass
+  Draw,          // CPU, render thread: the bar draw calls
+  GpuHeights,    // GPU time of the Heights stage
+  GpuDraw,       // GPU time of the Draw stage
+  Count
+};
+
+/**
+ * Rolling timings of the hot path stages, cheap enough to stay compiled in.
+ *
+ * Every stage has a fixed-size ring of its last RING_SIZE samples and an allocation counter.
+ * Record() is wait-free: a stage has a single writer thread, which stores the sample then bumps
+ * the write count, readers never block it. Summarize() copies a ring and sorts the copy, on any
+ * one other thread.
+ *
+ * While disabled, CTimer does not even read the clock. The constructor is the only call that
+ * allocates.
+ */
+class CFrameProfiler
+{
+public:
+  static const unsigned int RING_SIZE = 1024; // Samples kept per stage, a power of two
+
+  struct Summary
+  {
+    unsigned int samples;     // Samples the figures are computed from, up to RING_SIZE
+    float p50, p95, p99, max; // In milliseconds
+    unsigned int allocations; // Since the previous Summarize() of this stage
+  };
+
+  /**
+   * Times the scope it lives in as one sample of a stage, if the profiler is enabled.
+   */
+  class CTimer
+  {
+  public:
+    CTimer(CFrameProfiler& profiler, ProfileStage stage)
+      : m_profiler(profiler.IsEnabled() ? &profiler : nullptr), m_stage(stage)
+    {
+      if (m_profiler)
+        m_start = std::chrono::steady_clock::now();
+    }
+    ~CTimer()
+    {
+      if (m_profiler)
+        m_profiler->Record(m_stage, std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - m_start).count());
+    }
+    CTimer(const CTimer&) = delete;
+    CTimer& operator=(const CTimer&) = delete;
+
+  private:
+    CFrameProfiler* m_profiler;
+    ProfileStage m_stage;
+    std::chrono::steady_clock::time_point m_start;
+  };
+
+  CFrameProfiler();
+
+  void SetEnabled(bool enabled) { m_enabled.store(enabled, std::memory_order_relaxed); }
+  bool IsEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+  /**
+   * Adds a sample, from the only thread writing this stage.
+   *
+   * @param[in] stage
+   * @param[in] milliseconds
+   */
+  void Record(ProfileStage stage, float milliseconds);
+
+  /**
+   * Counts heap allocations made by a stage, from any thread.
+   */
+  void CountAllocations(ProfileStage stage, unsigned int count);
+
+  /**
+   * Computes the figures of the last RING_SIZE samples of a stage and restarts its allocation
+   * count. Not thread safe against itself.
+   *
+   * @return false if the stage has no sample yet.
+   */
+  bool Summarize(ProfileStage stage, Summary& summary);
+
+  static const char* StageName(ProfileStage stage);
+
+private:
+  struct Ring
+  {
+    std::atomic<float> values[RING_SIZE];
+    std::atomic<uint32_t> written{0};
+    std::atomic<uint32_t> allocations{0};
+  };
+
+  Ring m_rings[static_cast<unsigned int>(ProfileStage::Count)];
+  std::vector<float> m_sorted; // Summarize() work copy, RING_SIZE values
+  std::atomic<bool> m_enabled{false};
+};
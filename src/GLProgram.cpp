@@ -0,0 +1,351 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "GLProgram.h"
+
+#include <kodi/Filesystem.h>
+
+#include <algorithm>
+#include <chrono>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+/* Desktop GL and GLES 3.0 can hand a linked program over as a binary, GLES 2.0 only with an extension. */
+#if defined(HAS_GL) || (defined(HAS_GLES) && (HAS_GLES >= 3))
+#define SPECTRUM_PROGRAM_BINARY
+#endif
+
+namespace
+{
+
+struct EmbeddedShader
+{
+  const char* path;
+  const char* source;
+};
+
+const EmbeddedShader EMBEDDED_SHADERS[] =
+{
+#include "EmbeddedShaders.inc"
+};
+
+bool ReadFile(const std::string& path, std::string& content)
+{
+  kodi::vfs::CFile file;
+  if (!file.OpenFile(path))
+    return false;
+
+  const int64_t length = file.GetLength();
+  if (length < 0)
+    return false;
+  content.resize(static_cast<size_t>(length));
+  return length == 0 || file.Read(&content[0], content.size()) == length;
+}
+
+bool ReadSource(const char* path, std::string& source)
+{
+  if (!kodi::GetBaseUserPath().empty())
+  {
+    const std::string override = kodi::GetBaseUserPath(path);
+    if (kodi::vfs::FileExists(override) && ReadFile(override, source))
+    {
+      kodi::Log(ADDON_LOG_INFO, "Shader %s taken from %s", path, override.c_str());
+      return true;
+    }
+  }
+
+  for (const EmbeddedShader& shader : EMBEDDED_SHADERS)
+  {
+    if (strcmp(shader.path, path) == 0)
+    {
+      source = shader.source;
+      return true;
+    }
+  }
+  if (ReadFile(kodi::GetAddonPath(path), source))
+    return true;
+
+  kodi::Log(ADDON_LOG_ERROR, "Cannot find the shader %s", path);
+  return false;
+}
+
+GLuint CompileShader(GLenum type, const char* path, const std::string& source)
+{
+  const GLchar* text = source.c_str();
+  const GLuint shader = glCreateShader(type);
+  glShaderSource(shader, 1, &text, nullptr);
+  glCompileShader(shader);
+
+  GLint compiled = GL_FALSE;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+  if (compiled != GL_TRUE)
+  {
+    GLchar log[1024] = "";
+    glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+    kodi::Log(ADDON_LOG_ERROR, "Failed to compile %s: %s", path, log);
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+#ifdef SPECTRUM_PROGRAM_BINARY
+const char* CACHE_DIRECTORY = "shadercache";
+const char CACHE_MAGIC[4] = { 'S', 'P', 'C', 'B' };
+const uint32_t CACHE_VERSION = 1; // Bumped when the file layout changes
+
+/* Start of every cache file, followed by "length" bytes of program binary. */
+struct CacheHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint64_t key;    // See ProgramKey()
+  uint32_t format; // Binary format of the driver
+  uint32_t length;
+};
+
+/* 64-bit FNV-1a, of the terminating zero too so that the strings cannot run into each other. */
+uint64_t Hash(uint64_t hash, const char* text)
+{
+  if (text == nullptr)
+    text = "";
+  do
+  {
+    hash ^= static_cast<unsigned char>(*text);
+    hash *= 1099511628211ULL;
+  } while (*text++ != '\0');
+  return hash;
+}
+
+uint64_t ProgramKey(const std::string& vertexSource, const std::string& fragmentSource)
+{
+  uint64_t key = 14695981039346656037ULL;
+  key = Hash(key, reinterpret_cast<const char*>(glGetString(GL_VENDOR)));
+  key = Hash(key, reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+  key = Hash(key, reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+  key = Hash(key, vertexSource.c_str());
+  return Hash(key, fragmentSource.c_str());
+}
+
+/* Program binary formats of the driver, none if it cannot save programs. */
+std::vector<GLint> BinaryFormats()
+{
+#if defined(HAS_GL)
+  GLint major = 0;
+  GLint minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  bool available = major > 4 || (major == 4 && minor >= 1);
+  GLint extensions = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+  for (GLint i = 0; i < extensions && !available; i++)
+    available = strcmp(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)), "GL_ARB_get_program_binary") == 0;
+  if (!available)
+    return std::vector<GLint>();
+#endif
+
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &count);
+  std::vector<GLint> formats(std::max(count, 0));
+  if (count > 0)
+    glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, formats.data());
+  return formats;
+}
+
+/* "resources/shaders/GL/smooth_vert.glsl" and ".../smooth_frag.glsl" are kept in */
+/* "shadercache/smooth_vert+smooth_frag.bin". */
+std::string CacheFile(const char* vertex, const char* fragment)
+{
+  std::string name;
+  for (const char* path : { vertex, fragment })
+  {
+    const char* file = strrchr(path, '/');
+    file = file ? file + 1 : path;
+    const char* extension = strrchr(file, '.');
+    name += (name.empty() ? "" : "+") + std::string(file, extension ? extension - file : strlen(file));
+  }
+  return std::string(CACHE_DIRECTORY) + "/" + name + ".bin";
+}
+
+/* Links a program from its cache file, 0 if there is none for this key, or if the driver refuses it. */
+GLuint LoadBinary(const std::string& path, uint64_t key, const std::vector<GLint>& formats)
+{
+  kodi::vfs::CFile file;
+  if (!file.OpenFile(path))
+    return 0;
+
+  CacheHeader header;
+  if (file.Read(&header, sizeof(header)) != sizeof(header) ||
+      memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != CACHE_VERSION ||
+      header.key != key)
+  {
+    kodi::Log(ADDON_LOG_DEBUG, "%s is out of date", path.c_str());
+    return 0;
+  }
+  if (std::find(formats.begin(), formats.end(), static_cast<GLint>(header.format)) == formats.end())
+  {
+    kodi::Log(ADDON_LOG_DEBUG, "%s has a binary format the driver no longer takes", path.c_str());
+    return 0;
+  }
+
+  std::vector<char> binary(header.length);
+  if (file.Read(binary.data(), binary.size()) != static_cast<ssize_t>(binary.size()))
+  {
+    kodi::Log(ADDON_LOG_DEBUG, "%s is truncated", path.c_str());
+    return 0;
+  }
+
+  const GLuint program = glCreateProgram();
+  glProgramBinary(program, header.format, binary.data(), header.length);
+  GLint linked = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if (linked != GL_TRUE)
+  {
+    kodi::Log(ADDON_LOG_DEBUG, "The driver refused the program binary of %s", path.c_str());
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+void SaveBinary(GLuint program, const std::string& path, uint64_t key)
+{
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+    return;
+
+  std::vector<char> binary(length);
+  GLsizei written = 0;
+  GLenum format = 0;
+  glGetProgramBinary(program, length, &written, &format, binary.data());
+  if (written <= 0)
+    return;
+
+  CacheHeader header;
+  memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  header.version = CACHE_VERSION;
+  header.key = key;
+  header.format = format;
+  header.length = static_cast<uint32_t>(written);
+
+  // A partly written file fails its length check on the next load, it is only removed to be tidy
+  kodi::vfs::CFile file;
+  if (!kodi::vfs::CreateDirectory(kodi::GetBaseUserPath(CACHE_DIRECTORY)) || !file.OpenFileForWrite(path, true) ||
+      file.Write(&header, sizeof(header)) != sizeof(header) ||
+      file.Write(binary.data(), header.length) != static_cast<ssize_t>(header.length))
+  {
+    kodi::Log(ADDON_LOG_WARNING, "Cannot write the program binary %s", path.c_str());
+    file.Close();
+    kodi::vfs::DeleteFile(path);
+  }
+}
+#endif
+
+} // namespace
+
+bool CGLProgram::Load(const char* vertex, const char* fragment)
+{
+  Free();
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  std::string vertexSource;
+  std::string fragmentSource;
+  if (!ReadSource(vertex, vertexSource) || !ReadSource(fragment, fragmentSource))
+    return false;
+
+#ifdef SPECTRUM_PROGRAM_BINARY
+  std::string cacheFile;
+  uint64_t key = 0;
+  const std::vector<GLint> formats = BinaryFormats();
+  // Without a profile directory, there is nowhere to keep them
+  if (!formats.empty() && !kodi::GetBaseUserPath().empty())
+  {
+    cacheFile = kodi::GetBaseUserPath(CacheFile(vertex, fragment));
+    key = ProgramKey(vertexSource, fragmentSource);
+    m_program = LoadBinary(cacheFile, key, formats);
+    m_fromCache = m_program != 0;
+  }
+#endif
+
+  if (!m_fromCache)
+  {
+    const GLuint vertexShader = CompileShader(GL_VERTEX_SHADER, vertex, vertexSource);
+    const GLuint fragmentShader = CompileShader(GL_FRAGMENT_SHADER, fragment, fragmentSource);
+    if (vertexShader == 0 || fragmentShader == 0)
+    {
+      glDeleteShader(vertexShader);
+      glDeleteShader(fragmentShader);
+      return false;
+    }
+
+    m_program = glCreateProgram();
+    glAttachShader(m_program, vertexShader);
+    glAttachShader(m_program, fragmentShader);
+#ifdef SPECTRUM_PROGRAM_BINARY
+    if (!cacheFile.empty())
+      glProgramParameteri(m_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+#endif
+    glLinkProgram(m_program);
+    glDetachShader(m_program, vertexShader);
+    glDetachShader(m_program, fragmentShader);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(m_program, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE)
+    {
+      GLchar log[1024] = "";
+      glGetProgramInfoLog(m_program, sizeof(log), nullptr, log);
+      kodi::Log(ADDON_LOG_ERROR, "Failed to link %s and %s: %s", vertex, fragment, log);
+      Free();
+      return false;
+    }
+
+#ifdef SPECTRUM_PROGRAM_BINARY
+    if (!cacheFile.empty())
+      SaveBinary(m_program, cacheFile, key);
+#endif
+  }
+
+  m_loadMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+  kodi::Log(ADDON_LOG_DEBUG, "Program of %s and %s %s in %.2f ms", vertex, fragment,
+            m_fromCache ? "loaded from its binary" : "compiled", m_loadMilliseconds);
+
+  OnCompiledAndLinked();
+  return true;
+}
+
+void CGLProgram::Free()
+{
+  if (m_program != 0)
+    glDeleteProgram(m_program);
+  m_program = 0;
+  m_fromCache = false;
+}
+
+void CGLProgram::EnableShader()
+{
+  if (!ShaderOK())
+    return;
+
+  glUseProgram(m_program);
+  if (!OnEnabled())
+    glUseProgram(0);
+}
+
+void CGLProgram::DisableShader()
+{
+  if (!ShaderOK())
+    return;
+
+  glUseProgram(0);
+  OnDisabled();
+}
@@ -0,0 +1,63 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <kodi/AddonBase.h>
+#include <kodi/gui/gl/GL.h>
+
+/**
+ * A linked GLSL program, built from the shaders embedded in the add-on.
+ *
+ * Takes the place of kodi::gui::gl::CShaderProgram, which keeps its program to itself, so a
+ * program can be linked from a cached binary. Load() takes each shader from the first of:
+ *  - the same path in the add-on profile directory, a copy there overrides the built-in shader
+ *    while working on it, without a rebuild,
+ *  - the shaders embedded at build time, see EmbedShaders.cmake,
+ *  - the add-on directory, for a shader the build did not embed.
+ *
+ * With GL_ARB_get_program_binary (core in GL 4.1) and on GLES 3.0, a linked program is also kept
+ * in the profile directory, one file per program, and the next Load() links from it without
+ * compiling. Each file is keyed by the GL vendor, renderer and version and by both sources: after
+ * a driver update or an edited shader, or when the driver refuses the binary, the program is
+ * compiled again and the file replaced.
+ */
+class ATTRIBUTE_HIDDEN CGLProgram
+{
+public:
+  CGLProgram() = default;
+  CGLProgram(const CGLProgram&) = delete;
+  CGLProgram& operator=(const CGLProgram&) = delete;
+  virtual ~CGLProgram() { Free(); }
+
+  /**
+   * Builds the program, then calls OnCompiledAndLinked().
+   *
+   * @param[in] vertex Path of the vertex shader, relative to the add-on directory.
+   * @param[in] fragment Path of the fragment shader, the same way.
+   * @return false if a shader is missing or does not build, the reason is logged.
+   */
+  bool Load(const char* vertex, const char* fragment);
+  void Free();
+
+  void EnableShader();
+  void DisableShader();
+  bool ShaderOK() const { return m_program != 0; }
+  GLuint ProgramHandle() const { return m_program; }
+
+  bool FromCache() const { return m_fromCache; } // The last Load() skipped the compiler
+  float LoadMilliseconds() const { return m_loadMilliseconds; }
+
+  virtual void OnCompiledAndLinked() {}
+  virtual bool OnEnabled() { return true; } // false undoes EnableShader()
+  virtual void OnDisabled() {}
+
+private:
+  GLuint m_program = 0;
+  bool m_fromCache = false;
+  float m_loadMilliseconds = 0.0f;
+};
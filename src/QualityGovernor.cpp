@@ -0,0 +1,131 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "QualityGovernor.h"
+
+#include <algorithm>
+
+namespace
+{
+// From the full quality down, the render scale ones last, as not every framebuffer allows them
+const QualityLevel LEVELS[] =
+{
+  // rows   step  allFaces  renderScale
+  { 1.0f,   1,    true,     1.0f },
+  { 0.75f,  1,    true,     1.0f },
+  { 0.5f,   1,    true,     1.0f },
+  { 0.5f,   2,    true,     1.0f },
+  { 0.5f,   2,    false,    1.0f },
+  { 0.5f,   2,    false,    0.75f },
+  { 0.5f,   2,    false,    0.5f },
+};
+const unsigned int LEVEL_COUNT = sizeof(LEVELS) / sizeof(LEVELS[0]);
+
+// 90th percentile of a window, reorders the samples
+float P90(float* samples, unsigned int count)
+{
+  float* nth = samples + count * 9 / 10;
+  std::nth_element(samples, nth, samples + count);
+  return *nth;
+}
+}
+
+unsigned int CQualityGovernor::LevelCount()
+{
+  return LEVEL_COUNT;
+}
+
+const QualityLevel& CQualityGovernor::LevelAt(unsigned int level)
+{
+  return LEVELS[std::min(level, LEVEL_COUNT - 1)];
+}
+
+void CQualityGovernor::SetTarget(float frameMilliseconds)
+{
+  frameMilliseconds = std::max(frameMilliseconds, 0.0f);
+  if (frameMilliseconds == m_target)
+    return;
+
+  m_target = frameMilliseconds;
+  m_level = 0;
+  m_upWindows = MIN_UP_WINDOWS;
+  m_windowsSinceUp = 0;
+  Restart();
+}
+
+void CQualityGovernor::SetLevelCount(unsigned int count)
+{
+  m_levels = std::max(1U, std::min(count, LEVEL_COUNT));
+  m_level = std::min(m_level, m_levels - 1);
+}
+
+bool CQualityGovernor::AddFrame(float renderMilliseconds, float frameMilliseconds)
+{
+  if (!IsEnabled())
+    return false;
+
+  m_render[m_samples] = renderMilliseconds;
+  m_frame[m_samples] = frameMilliseconds;
+  if (renderMilliseconds > m_target * RENDER_SHARE || frameMilliseconds > m_target * 1.5f)
+    m_misses++;
+  if (++m_samples < WINDOW)
+    return false;
+
+  return Decide();
+}
+
+void CQualityGovernor::Restart()
+{
+  m_samples = 0;
+  m_misses = 0;
+  m_goodWindows = 0;
+}
+
+bool CQualityGovernor::Decide()
+{
+  m_window.renderP90 = P90(m_render, WINDOW);
+  m_window.frameP90 = P90(m_frame, WINDOW);
+  m_window.misses = m_misses;
+  if (m_windowsSinceUp > 0)
+    m_windowsSinceUp++;
+
+  const unsigned int level = m_level;
+  const unsigned int goodWindows = m_goodWindows;
+  Restart();
+
+  if (m_window.misses > MAX_MISSES)
+  {
+    if (level + 1 < m_levels)
+    {
+      // Right after a level up, that one was one too many
+      if (m_windowsSinceUp > 0 && m_windowsSinceUp <= 2)
+        m_upWindows = std::min(m_upWindows * 2, static_cast<unsigned int>(MAX_UP_WINDOWS));
+      m_windowsSinceUp = 0;
+      m_level = level + 1;
+    }
+  }
+  else if (m_window.misses == 0 && m_window.renderP90 <= m_target * RENDER_SHARE * UP_SHARE)
+  {
+    m_goodWindows = goodWindows + 1;
+    if (level > 0 && m_goodWindows >= m_upWindows)
+    {
+      m_goodWindows = 0;
+      m_windowsSinceUp = 1;
+      m_level = level - 1;
+    }
+  }
+
+  // A level up that held for long clears the back-off
+  if (m_windowsSinceUp > 2 * m_upWindows)
+  {
+    m_upWindows = MIN_UP_WINDOWS;
+    m_windowsSinceUp = 0;
+  }
+  m_window.goodWindows = m_goodWindows;
+  m_window.upWindows = m_upWindows;
+  return m_level != level;
+}
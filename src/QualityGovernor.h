@@ -0,0 +1,102 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+/**
+ * What the renderer draws at one quality level.
+ */
+struct QualityLevel
+{
+  float rows;            // Part of the history rows drawn, the newest ones
+  unsigned int bandStep; // Every bandStep-th band is drawn, with wider bars
+  bool allFaces;         // Otherwise the sides between neighbouring bands are left out
+  float renderScale;     // The scene is drawn in this part of the viewport, then stretched over it
+};
+
+/**
+ * Steps the drawing quality down when frames miss their budget, and back up once they fit again.
+ *
+ * Every rendered frame is fed with its Render() cost and the time since the previous frame. A
+ * frame misses when Render() takes more than RENDER_SHARE of the target frame time, or when the
+ * frame itself takes half as long again as the target (the GPU, or Kodi, did not keep up). Every
+ * WINDOW frames:
+ *  - more than MAX_MISSES misses step one level down,
+ *  - no miss, with a p90 Render() cost within UP_SHARE of the budget, counts as a good window.
+ *    After enough good windows in a row, one level up. A level up missed in the very next windows
+ *    doubles the good windows needed before the next try, so the level does not flip-flop.
+ *
+ * The levels go down history depth first, then bands, face detail and render scale. GL-free, only
+ * ever used from the render thread. Nothing allocates.
+ */
+class CQualityGovernor
+{
+public:
+  static const unsigned int WINDOW = 60;        // Frames per decision
+  static const unsigned int MAX_MISSES = 6;     // Misses a window tolerates
+  static const unsigned int MIN_UP_WINDOWS = 3; // Good windows before a level up, at first
+  static const unsigned int MAX_UP_WINDOWS = 48;
+  static constexpr float RENDER_SHARE = 0.5f;   // Part of the frame time Render() may take
+  static constexpr float UP_SHARE = 0.5f;       // Part of the Render() budget left for a level up
+
+  /**
+   * Figures of the last complete window, for the log.
+   */
+  struct Window
+  {
+    float renderP90;       // In milliseconds
+    float frameP90;
+    unsigned int misses;
+    unsigned int goodWindows; // Good windows in a row so far,
+    unsigned int upWindows;   // out of the ones a level up needs
+  };
+
+  /**
+   * Sets the frame time to hold, 0 to turn the governor off. Back to the full quality level when
+   * the target changes, nothing happens otherwise.
+   */
+  void SetTarget(float frameMilliseconds);
+  float Target() const { return m_target; }
+  bool IsEnabled() const { return m_target > 0.0f; }
+
+  /**
+   * Limits the levels to the first "count" ones, when the renderer cannot do the last ones.
+   */
+  void SetLevelCount(unsigned int count);
+
+  /**
+   * Adds a rendered frame.
+   *
+   * @param[in] renderMilliseconds Cost of the Render() call.
+   * @param[in] frameMilliseconds Time since the previous Render() call.
+   * @return true if the level changed, Level() then tells which one to draw at.
+   */
+  bool AddFrame(float renderMilliseconds, float frameMilliseconds);
+
+  unsigned int Level() const { return m_level; }
+  const QualityLevel& Current() const { return LevelAt(m_level); }
+  const Window& LastWindow() const { return m_window; }
+
+  static unsigned int LevelCount();
+  static const QualityLevel& LevelAt(unsigned int level);
+
+private:
+  void Restart();
+  bool Decide();
+
+  float m_target = 0.0f;
+  unsigned int m_levels = 1;
+  unsigned int m_level = 0;
+  float m_render[WINDOW]; // Samples of the current window
+  float m_frame[WINDOW];
+  unsigned int m_samples = 0;
+  unsigned int m_misses = 0;
+  unsigned int m_goodWindows = 0;
+  unsigned int m_upWindows = MIN_UP_WINDOWS;
+  unsigned int m_windowsSinceUp = 0; // Since the last level up, 0 before the first one
+  Window m_window = {0.0f, 0.0f, 0, 0, MIN_UP_WINDOWS};
+};
@@ -0,0 +1,219 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "RealFFT.h"
+
+#include <math.h>
+
+namespace
+{
+const double PI = 3.14159265358979323846;
+}
+
+bool CRealFFT::Configure(unsigned int size)
+{
+  if (size < MIN_SIZE || size > MAX_SIZE || (size & (size - 1)) != 0)
+    return false;
+  if (size == m_size)
+    return true;
+
+  const unsigned int half = size / 2;
+  unsigned int bits = 0;
+  while ((1U << bits) < half)
+    bits++;
+
+  m_bitReverse.resize(half);
+  for (unsigned int i = 0; i < half; i++)
+  {
+    uint32_t reversed = 0;
+    for (unsigned int bit = 0; bit < bits; bit++)
+      reversed |= ((i >> bit) & 1) << (bits - 1 - bit);
+    m_bitReverse[i] = reversed;
+  }
+
+  // Twiddles of the stages of length 2, 4, ... N / 2, one after the other
+  m_twiddleReal.clear();
+  m_twiddleImag.clear();
+  m_twiddleReal.reserve(half - 1);
+  m_twiddleImag.reserve(half - 1);
+  for (unsigned int length = 2; length <= half; length *= 2)
+  {
+    for (unsigned int j = 0; j < length / 2; j++)
+    {
+      const double angle = -2.0 * PI * j / length;
+      m_twiddleReal.push_back(static_cast<float>(cos(angle)));
+      m_twiddleImag.push_back(static_cast<float>(sin(angle)));
+    }
+  }
+
+  // The split step handles bins k and N / 2 - k together, it only needs the first quarter turn
+  m_splitReal.resize(half / 2 + 1);
+  m_splitImag.resize(half / 2 + 1);
+  for (unsigned int k = 0; k <= half / 2; k++)
+  {
+    const double angle = -2.0 * PI * k / size;
+    m_splitReal[k] = static_cast<float>(cos(angle));
+    m_splitImag[k] = static_cast<float>(sin(angle));
+  }
+
+  m_real.resize(half);
+  m_imag.resize(half);
+  m_size = size;
+  return true;
+}
+
+void CRealFFT::Transform(const float* input)
+{
+  const unsigned int half = m_size / 2;
+  float* re = m_real.data();
+  float* im = m_imag.data();
+
+  // z(n) = x(2n) + i * x(2n + 1), stored in bit-reversed order
+  for (unsigned int n = 0; n < half; n++)
+  {
+    const uint32_t to = m_bitReverse[n];
+    re[to] = input[2 * n];
+    im[to] = input[2 * n + 1];
+  }
+
+  // The first stage has no twiddle
+  for (unsigned int a = 0; a < half; a += 2)
+  {
+    const float tr = re[a + 1];
+    const float ti = im[a + 1];
+    re[a + 1] = re[a] - tr;
+    im[a + 1] = im[a] - ti;
+    re[a] += tr;
+    im[a] += ti;
+  }
+
+  // Then two stages per pass (radix-4), which halves the passes over the data. The twiddles of
+  // the stage of span "s" start at index s - 1.
+  unsigned int span = 2;
+  for (; span * 4 <= half; span *= 4)
+  {
+    const float* wr1 = m_twiddleReal.data() + span - 1;
+    const float* wi1 = m_twiddleImag.data() + span - 1;
+    const float* wr2 = m_twiddleReal.data() + 2 * span - 1;
+    const float* wi2 = m_twiddleImag.data() + 2 * span - 1;
+    for (unsigned int start = 0; start < half; start += 4 * span)
+    {
+      float* re0 = re + start;
+      float* im0 = im + start;
+      for (unsigned int j = 0; j < span; j++)
+      {
+        const unsigned int a0 = j, a1 = j + span, a2 = j + 2 * span, a3 = j + 3 * span;
+
+        // Stage of span s: (a0, a1) and (a2, a3), same twiddle
+        float tr = re0[a1] * wr1[j] - im0[a1] * wi1[j];
+        float ti = re0[a1] * wi1[j] + im0[a1] * wr1[j];
+        float r0 = re0[a0] + tr, i0 = im0[a0] + ti;
+        float r1 = re0[a0] - tr, i1 = im0[a0] - ti;
+        tr = re0[a3] * wr1[j] - im0[a3] * wi1[j];
+        ti = re0[a3] * wi1[j] + im0[a3] * wr1[j];
+        float r2 = re0[a2] + tr, i2 = im0[a2] + ti;
+        float r3 = re0[a2] - tr, i3 = im0[a2] - ti;
+
+        // Stage of span 2s: (a0, a2) and (a1, a3)
+        tr = r2 * wr2[j] - i2 * wi2[j];
+        ti = r2 * wi2[j] + i2 * wr2[j];
+        re0[a0] = r0 + tr;
+        im0[a0] = i0 + ti;
+        re0[a2] = r0 - tr;
+        im0[a2] = i0 - ti;
+        tr = r3 * wr2[j + span] - i3 * wi2[j + span];
+        ti = r3 * wi2[j + span] + i3 * wr2[j + span];
+        re0[a1] = r1 + tr;
+        im0[a1] = i1 + ti;
+        re0[a3] = r1 - tr;
+        im0[a3] = i1 - ti;
+      }
+    }
+  }
+
+  // A last radix-2 stage when the number of stages left is odd
+  if (span * 2 <= half)
+  {
+    const float* wr = m_twiddleReal.data() + span - 1;
+    const float* wi = m_twiddleImag.data() + span - 1;
+    float* re1 = re + span;
+    float* im1 = im + span;
+    for (unsigned int j = 0; j < span; j++)
+    {
+      const float tr = re1[j] * wr[j] - im1[j] * wi[j];
+      const float ti = re1[j] * wi[j] + im1[j] * wr[j];
+      re1[j] = re[j] - tr;
+      im1[j] = im[j] - ti;
+      re[j] += tr;
+      im[j] += ti;
+    }
+  }
+}
+
+void CRealFFT::Forward(const float* input, float* real, float* imag)
+{
+  Transform(input);
+
+  const unsigned int half = m_size / 2;
+  const float* re = m_real.data();
+  const float* im = m_imag.data();
+
+  real[0] = re[0] + im[0];
+  imag[0] = 0.0f;
+  real[half] = re[0] - im[0];
+  imag[half] = 0.0f;
+
+  // X(k) = E(k) + W^k * O(k), with E and O the spectra of the even and odd samples, taken from
+  // Z(k) and Z(N / 2 - k). W^(N / 2 - k) is -conj(W^k).
+  for (unsigned int k = 1; k <= half / 2; k++)
+  {
+    const unsigned int j = half - k;
+    const float evenReal = 0.5f * (re[k] + re[j]);
+    const float evenImag = 0.5f * (im[k] - im[j]);
+    const float oddReal = 0.5f * (im[k] + im[j]);
+    const float oddImag = 0.5f * (re[j] - re[k]);
+    const float wr = m_splitReal[k];
+    const float wi = m_splitImag[k];
+    const float productReal = wr * oddReal - wi * oddImag;
+    const float productImag = wr * oddImag + wi * oddReal;
+
+    real[k] = evenReal + productReal;
+    imag[k] = evenImag + productImag;
+    real[j] = evenReal - productReal;
+    imag[j] = productImag - evenImag;
+  }
+}
+
+void CRealFFT::Magnitudes(const float* input, float* magnitudes, float scale)
+{
+  Transform(input);
+
+  const unsigned int half = m_size / 2;
+  const float* re = m_real.data();
+  const float* im = m_imag.data();
+
+  magnitudes[0] = fabsf(re[0] + im[0]) * scale;
+  for (unsigned int k = 1; k <= half / 2; k++)
+  {
+    const unsigned int j = half - k;
+    const float evenReal = 0.5f * (re[k] + re[j]);
+    const float evenImag = 0.5f * (im[k] - im[j]);
+    const float oddReal = 0.5f * (im[k] + im[j]);
+    const float oddImag = 0.5f * (re[j] - re[k]);
+    const float wr = m_splitReal[k];
+    const float wi = m_splitImag[k];
+    const float productReal = wr * oddReal - wi * oddImag;
+    const float productImag = wr * oddImag + wi * oddReal;
+
+    const float kReal = evenReal + productReal;
+    const float kImag = evenImag + productImag;
+    const float jReal = evenReal - productReal;
+    const float jImag = productImag - evenImag;
+    magnitudes[k] = sqrtf(kReal * kReal + kImag * kImag) * scale;
+    magnitudes[j] = sqrtf(jReal * jReal + jImag * jImag) * scale;
+  }
+}
@@ -0,0 +1,72 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Forward FFT of real samples, for power of two sizes.
+ *
+ * A size N transform packs the even and odd samples into the real and imaginary parts of N / 2
+ * complex values, runs an iterative FFT on them and splits the result into the N / 2 + 1 bins of
+ * the real spectrum. The bit-reversal permutation is folded into the packing. After a first
+ * radix-2 stage without twiddles, the FFT does two stages per pass (radix-4), with a last radix-2
+ * stage when an odd number of them is left.
+ *
+ * Everything depending on the size (bit-reversal table, twiddles of every stage, stored in stage
+ * order so each stage reads them sequentially, and the work buffers) is computed by Configure(),
+ * the transforms themselves never allocate.
+ */
+class CRealFFT
+{
+public:
+  static const unsigned int MIN_SIZE = 4;
+  static const unsigned int MAX_SIZE = 65536;
+
+  /**
+   * Prepares the tables for a size N transform. Allocates only when the size changes.
+   *
+   * @param[in] size N, a power of two between MIN_SIZE and MAX_SIZE.
+   * @return false if the size is not supported, the previous configuration is kept then.
+   */
+  bool Configure(unsigned int size);
+
+  unsigned int Size() const { return m_size; }
+
+  /**
+   * Computes the bins 0 to N / 2 of the spectrum of N samples.
+   *
+   * @param[in] input N real samples.
+   * @param[out] real N / 2 + 1 real parts.
+   * @param[out] imag N / 2 + 1 imaginary parts, the first and last ones are always 0.
+   */
+  void Forward(const float* input, float* real, float* imag);
+
+  /**
+   * Computes the magnitude of the bins 0 to N / 2 - 1 of the spectrum of N samples, the layout of
+   * the FFT data Kodi hands over (no Nyquist bin).
+   *
+   * @param[in] input N real samples.
+   * @param[out] magnitudes N / 2 values, |X(k)| * scale.
+   * @param[in] scale Applied to every magnitude, 2 / sum(window) gives the amplitude of a sine.
+   */
+  void Magnitudes(const float* input, float* magnitudes, float scale);
+
+private:
+  void Transform(const float* input);
+
+  unsigned int m_size = 0;
+  std::vector<uint32_t> m_bitReverse; // N / 2 entries
+  std::vector<float> m_twiddleReal;   // N / 2 - 1 entries, e^(-2*pi*i*j/len) for every stage "len"
+  std::vector<float> m_twiddleImag;
+  std::vector<float> m_splitReal;     // N / 4 + 1 entries, e^(-2*pi*i*k/N)
+  std::vector<float> m_splitImag;
+  std::vector<float> m_real;          // N / 2 complex work values
+  std::vector<float> m_imag;
+};
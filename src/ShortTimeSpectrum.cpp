@@ -0,0 +1,207 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "ShortTimeSpectrum.h"
+
+#include <algorithm>
+#include <math.h>
+
+// Splitting channels is only a few shuffles per sample, the baseline SIMD of the target is enough
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SPECTRUM_DEINTERLEAVE_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define SPECTRUM_DEINTERLEAVE_NEON
+#endif
+
+namespace
+{
+const double PI = 3.14159265358979323846;
+}
+
+bool CShortTimeSpectrum::Configure(unsigned int size,
+                                   SpectrumWindow window,
+                                   float overlap,
+                                   unsigned int channels,
+                                   SpectrumChannels layout)
+{
+  if (!m_fft.Configure(size))
+    return false;
+
+  // Periodic windows, so overlapping frames add up evenly. The one of the previous song is kept
+  // when it is the same.
+  if (m_window.size() != size || m_windowType != window)
+  {
+    m_window.resize(size);
+    double sum = 0.0;
+    for (unsigned int i = 0; i < size; i++)
+    {
+      const double phase = 2.0 * PI * i / size;
+      double value;
+      if (window == SpectrumWindow::Blackman)
+        value = 0.42 - 0.5 * cos(phase) + 0.08 * cos(2.0 * phase);
+      else
+        value = 0.5 - 0.5 * cos(phase);
+      m_window[i] = static_cast<float>(value);
+      sum += value;
+    }
+    m_scale = static_cast<float>(2.0 / sum);
+    m_windowType = window;
+  }
+
+  overlap = std::min(std::max(overlap, 0.0f), 0.875f);
+  m_hop = std::max(1U, static_cast<unsigned int>(lroundf(size * (1.0f - overlap))));
+  m_channels = std::max(1U, channels);
+  m_layout = m_channels >= 2 ? layout : SpectrumChannels::Mono;
+  m_outputs = m_layout == SpectrumChannels::Mono ? 1 : 2;
+
+  for (unsigned int output = 0; output < MAX_OUTPUTS; output++)
+  {
+    const unsigned int length = output < m_outputs ? size : 0;
+    m_rings[output].resize(length);
+    m_magnitudes[output].resize(length / 2);
+    m_bins[output] = m_magnitudes[output].data();
+  }
+  m_frame.resize(size);
+  Clear();
+  return true;
+}
+
+void CShortTimeSpectrum::Clear()
+{
+  for (std::vector<float>& ring : m_rings)
+    std::fill(ring.begin(), ring.end(), 0.0f);
+  m_write = 0;
+  m_untilNextFrame = m_hop;
+  m_position = 0;
+}
+
+void CShortTimeSpectrum::Deinterleave(const float* samples, unsigned int frames, float* first, float* second, bool midSide)
+{
+  unsigned int i = 0;
+
+#if defined(SPECTRUM_DEINTERLEAVE_SSE2)
+  const __m128 half = _mm_set1_ps(0.5f);
+  for (; i + 4 <= frames; i += 4)
+  {
+    const __m128 a = _mm_loadu_ps(samples + 2 * i);     // L0 R0 L1 R1
+    const __m128 b = _mm_loadu_ps(samples + 2 * i + 4); // L2 R2 L3 R3
+    __m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+    if (midSide)
+    {
+      const __m128 mid = _mm_mul_ps(_mm_add_ps(left, right), half);
+      right = _mm_mul_ps(_mm_sub_ps(left, right), half);
+      left = mid;
+    }
+    _mm_storeu_ps(first + i, left);
+    _mm_storeu_ps(second + i, right);
+  }
+#elif defined(SPECTRUM_DEINTERLEAVE_NEON)
+  const float32x4_t half = vdupq_n_f32(0.5f);
+  for (; i + 4 <= frames; i += 4)
+  {
+    float32x4x2_t split = vld2q_f32(samples + 2 * i);
+    if (midSide)
+    {
+      const float32x4_t mid = vmulq_f32(vaddq_f32(split.val[0], split.val[1]), half);
+      split.val[1] = vmulq_f32(vsubq_f32(split.val[0], split.val[1]), half);
+      split.val[0] = mid;
+    }
+    vst1q_f32(first + i, split.val[0]);
+    vst1q_f32(second + i, split.val[1]);
+  }
+#endif
+
+  for (; i < frames; i++)
+  {
+    const float left = samples[2 * i];
+    const float right = samples[2 * i + 1];
+    first[i] = midSide ? (left + right) * 0.5f : left;
+    second[i] = midSide ? (left - right) * 0.5f : right;
+  }
+}
+
+unsigned int CShortTimeSpectrum::Fill(const float* samples, unsigned int count)
+{
+  const unsigned int frames = std::min(count / m_channels, m_untilNextFrame);
+  const unsigned int size = static_cast<unsigned int>(m_rings[0].size());
+  const unsigned int mask = size - 1;
+  float* ring = m_rings[0].data();
+
+  if (m_outputs == 2)
+  {
+    // Up to the end of the rings, then from their start
+    const bool midSide = m_layout == SpectrumChannels::MidSide;
+    float* second = m_rings[1].data();
+    unsigned int done = 0;
+    while (done < frames)
+    {
+      const unsigned int write = (m_write + done) & mask;
+      const unsigned int length = std::min(frames - done, size - write);
+      if (m_channels == 2)
+      {
+        Deinterleave(samples + done * 2, length, ring + write, second + write, midSide);
+      }
+      else
+      {
+        for (unsigned int i = 0; i < length; i++)
+        {
+          const float left = samples[(done + i) * m_channels];
+          const float right = samples[(done + i) * m_channels + 1];
+          ring[write + i] = midSide ? (left + right) * 0.5f : left;
+          second[write + i] = midSide ? (left - right) * 0.5f : right;
+        }
+      }
+      done += length;
+    }
+  }
+  else if (m_channels == 1)
+  {
+    for (unsigned int i = 0; i < frames; i++)
+      ring[(m_write + i) & mask] = samples[i];
+  }
+  else
+  {
+    const float gain = 1.0f / m_channels;
+    for (unsigned int i = 0; i < frames; i++)
+    {
+      float sum = 0.0f;
+      for (unsigned int channel = 0; channel < m_channels; channel++)
+        sum += samples[i * m_channels + channel];
+      ring[(m_write + i) & mask] = sum * gain;
+    }
+  }
+
+  m_write = (m_write + frames) & mask;
+  m_untilNextFrame -= frames;
+  m_position += frames;
+  return frames * m_channels;
+}
+
+const float* const* CShortTimeSpectrum::Transform()
+{
+  m_untilNextFrame = m_hop;
+
+  // Unrolls every ring, oldest sample first, and applies the window on the way
+  const unsigned int size = static_cast<unsigned int>(m_rings[0].size());
+  const unsigned int tail = size - m_write;
+  const float* window = m_window.data();
+  float* frame = m_frame.data();
+  for (unsigned int output = 0; output < m_outputs; output++)
+  {
+    const float* ring = m_rings[output].data();
+    for (unsigned int i = 0; i < tail; i++)
+      frame[i] = ring[m_write + i] * window[i];
+    for (unsigned int i = tail; i < size; i++)
+      frame[i] = ring[i - tail] * window[i];
+
+    m_fft.Magnitudes(frame, m_magnitudes[output].data(), m_scale);
+  }
+  return m_bins;
+}
@@ -0,0 +1,131 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include "RealFFT.h"
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Window applied to every frame before the FFT.
+ */
+enum class SpectrumWindow
+{
+  Hann = 0,    // Good frequency resolution, -31 dB side lobes
+  Blackman = 1 // Wider peaks, -58 dB side lobes, less leakage between bands
+};
+
+/**
+ * Signals a CShortTimeSpectrum computes the spectra of.
+ */
+enum class SpectrumChannels
+{
+  Mono = 0,      // All the channels mixed down, one spectrum
+  LeftRight = 1, // First and second channel, two spectra
+  MidSide = 2    // Half their sum and half their difference, two spectra
+};
+
+/**
+ * Magnitude spectra of overlapping frames of the PCM stream.
+ *
+ * Interleaved samples are mixed down to mono, or split into two signals (see SpectrumChannels),
+ * into ring buffers of one FFT length. Stereo samples are split with SIMD shuffles. Every "hop"
+ * samples, the last FFT length of every signal is windowed and transformed. The magnitudes are
+ * scaled so a full scale sine peaks around 1, like the FFT data Kodi hands over.
+ *
+ * Configure() is the only call that allocates.
+ */
+class CShortTimeSpectrum
+{
+public:
+  /**
+   * @param[in] size FFT length, a power of two up to CRealFFT::MAX_SIZE.
+   * @param[in] window Window of every frame.
+   * @param[in] overlap Part of a frame shared with the next one, from 0 to 0.875.
+   * @param[in] channels Number of interleaved channels of the samples.
+   * @param[in] layout Signals to analyse, mono only when there is a single channel.
+   * @return false if the size is not supported, the previous configuration is kept then.
+   */
+  bool Configure(unsigned int size,
+                 SpectrumWindow window,
+                 float overlap,
+                 unsigned int channels,
+                 SpectrumChannels layout = SpectrumChannels::Mono);
+
+  /**
+   * Restarts from silence, without changing the configuration.
+   */
+  void Clear();
+
+  /**
+   * Appends interleaved samples, calls "consumer(const float* const* bins, unsigned int length)"
+   * for every frame they complete, oldest first, with the bins of the Outputs() signals. A
+   * trailing incomplete sample frame is dropped.
+   */
+  template<typename Consumer>
+  void Write(const float* samples, unsigned int count, Consumer consumer)
+  {
+    if (m_rings[0].empty())
+      return;
+
+    count -= count % m_channels;
+    while (count > 0)
+    {
+      const unsigned int used = Fill(samples, count);
+      samples += used;
+      count -= used;
+      if (m_untilNextFrame == 0)
+        consumer(Transform(), Bins());
+    }
+  }
+
+  /**
+   * Splits "frames" interleaved stereo sample frames into two signals, see SpectrumChannels.
+   * Uses SSE2 or NEON when the build targets them.
+   */
+  static void Deinterleave(const float* samples, unsigned int frames, float* first, float* second, bool midSide);
+
+  /**
+   * Number of spectra of every frame, 1 or 2.
+   */
+  unsigned int Outputs() const { return m_outputs; }
+  SpectrumChannels Layout() const { return m_layout; }
+
+  unsigned int Size() const { return m_fft.Size(); }
+  unsigned int Bins() const { return m_fft.Size() / 2; }
+  unsigned int Hop() const { return m_hop; }
+
+  /**
+   * Number of sample frames written since the last Clear(). In a consumer, the frame being
+   * handed over ends there.
+   */
+  uint64_t Position() const { return m_position; }
+
+private:
+  static const unsigned int MAX_OUTPUTS = 2;
+
+  unsigned int Fill(const float* samples, unsigned int count);
+  const float* const* Transform();
+
+  CRealFFT m_fft;
+  std::vector<float> m_window;
+  SpectrumWindow m_windowType = SpectrumWindow::Hann; // Of m_window
+  std::vector<float> m_rings[MAX_OUTPUTS];       // Last FFT length of every signal, m_write being the oldest
+  std::vector<float> m_frame;                    // Windowed frame, in time order
+  std::vector<float> m_magnitudes[MAX_OUTPUTS];  // Bins() values per signal
+  const float* m_bins[MAX_OUTPUTS] = {nullptr, nullptr}; // Handed to the consumer
+  float m_scale = 1.0f;            // 2 / sum(window)
+  SpectrumChannels m_layout = SpectrumChannels::Mono;
+  unsigned int m_outputs = 1;
+  unsigned int m_channels = 1;
+  unsigned int m_hop = 1;
+  unsigned int m_write = 0;
+  unsigned int m_untilNextFrame = 1;
+  uint64_t m_position = 0;
+};
@@ -0,0 +1,161 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "SpectrumAnalyzer.h"
+
+#include <algorithm>
+#include <math.h>
+
+namespace
+{
+// Largest height difference between two rows still seen as the same, far below a pixel
+const float STEADY_EPSILON = 1e-4f;
+}
+
+void CSpectrumAnalyzer::Configure(unsigned int bands, unsigned int depth, unsigned int sampleRate, unsigned int grids)
+{
+  m_grids = grids == 2 ? 2 : 1;
+  if (m_history.Bands() != bands * m_grids || m_history.Depth() != depth)
+    m_history.Resize(bands * m_grids, depth);
+  m_mirrored.resize(m_grids == 2 ? bands : 0);
+
+  // The FFT length is only known on the first Push(), the band table gets completed there. The
+  // table of the previous song is kept when it is for the same bands and rate.
+  m_sampleRate = sampleRate > 0 ? sampleRate : CBandMapper::DEFAULT_SAMPLE_RATE;
+  if (m_bandMapper.BandCount() != bands || m_bandMapper.SampleRate() != m_sampleRate)
+    m_bandMapper.Configure(bands, m_bandMapper.Bins(), m_sampleRate);
+
+  m_history.Clear();
+  m_snapshots.Reset(m_history);
+}
+
+bool CSpectrumAnalyzer::ConfigureSignal(unsigned int fftSize,
+                                        SpectrumWindow window,
+                                        float overlap,
+                                        unsigned int channels,
+                                        SpectrumChannels layout)
+{
+  return m_signal.Configure(fftSize, window, overlap, channels, layout);
+}
+
+void CSpectrumAnalyzer::SetKernelParams(const BandKernelParams& params)
+{
+  m_newKernelParams.Back() = params;
+  m_newKernelParams.Publish();
+}
+
+bool CSpectrumAnalyzer::Push(const float* freqData, unsigned int freqDataLength, double time)
+{
+  const bool reconfigure = PushRow(&freqData, 1, freqDataLength, time);
+  Publish();
+  return reconfigure;
+}
+
+bool CSpectrumAnalyzer::PushAudio(const float* samples, unsigned int count)
+{
+  // Depending on the hop, a call completes no frame at all or several ones, the render thread
+  // only gets the history once they are all in
+  bool reconfigure = false;
+  unsigned int rows = 0;
+  m_signal.Write(samples, count, [&](const float* const* bins, unsigned int length) {
+    reconfigure |= PushRow(bins, m_signal.Outputs(), length, static_cast<double>(m_signal.Position()) / m_sampleRate);
+    rows++;
+  });
+
+  if (rows > 0)
+    Publish();
+  return reconfigure;
+}
+
+bool CSpectrumAnalyzer::PushRow(const float* const* freqData, unsigned int signals, unsigned int freqDataLength, double time)
+{
+  // The band table only depends on the FFT length and the sample rate
+  const unsigned int bands = m_history.Bands() / m_grids;
+  const bool reconfigure = !m_bandMapper.IsConfiguredFor(freqDataLength, m_sampleRate);
+  if (reconfigure)
+    m_bandMapper.Configure(bands, freqDataLength, m_sampleRate);
+  if (m_newKernelParams.Update())
+    m_kernelParams = m_newKernelParams.Front();
+
+  // The history is a ring buffer, this only recycles the oldest row as the newest one
+  float* row = m_history.Push(time);
+  if (m_grids == 2)
+  {
+    // The first grid is mirrored, the same band table serves both
+    float* mirrored = m_mirrored.data();
+    m_bandKernel.Process(m_bandMapper, freqData[0], mirrored, m_kernelParams);
+    for (unsigned int x = 0; x < bands; x++)
+      row[x] = mirrored[bands - 1 - x];
+    m_bandKernel.Process(m_bandMapper, freqData[signals - 1], row + bands, m_kernelParams);
+  }
+  else
+  {
+    m_bandKernel.Process(m_bandMapper, freqData[0], row, m_kernelParams);
+  }
+  TrackChanges();
+  return reconfigure;
+}
+
+void CSpectrumAnalyzer::PushSilence(double time)
+{
+  PushConstant(0.0f, time);
+  Publish();
+}
+
+void CSpectrumAnalyzer::PushConstant(float height, double time)
+{
+  float* row = m_history.Push(time);
+  for (unsigned int x = 0; x < m_history.Bands(); x++)
+    row[x] = height;
+  TrackChanges();
+}
+
+void CSpectrumAnalyzer::TrackChanges()
+{
+  // One pass over the new row, next to the band kernel it is nothing
+  unsigned int steadyRows = 0;
+  if (m_history.Depth() > 1)
+  {
+    const float* newest = m_history.Row(0);
+    const float* previous = m_history.Row(1);
+    float change = 0.0f;
+    for (unsigned int x = 0; x < m_history.Bands(); x++)
+      change = fmaxf(change, fabsf(newest[x] - previous[x]));
+    if (change <= STEADY_EPSILON)
+      steadyRows = std::min(m_history.SteadyRows() + 1, m_history.Depth());
+  }
+  m_history.SetSteadyRows(steadyRows);
+}
+
+float CSpectrumAnalyzer::MeanSquare(const float* samples, unsigned int count)
+{
+  if (count == 0)
+    return 0.0f;
+
+  float sums[8] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+  const float* end = samples + (count & ~7U);
+  for (const float* block = samples; block != end; block += 8)
+  {
+    for (unsigned int lane = 0; lane < 8; lane++)
+      sums[lane] += block[lane] * block[lane];
+  }
+  for (unsigned int i = count & ~7U; i < count; i++)
+    sums[0] += samples[i] * samples[i];
+
+  float sum = 0.0f;
+  for (unsigned int lane = 0; lane < 8; lane++)
+    sum += sums[lane];
+  return sum / count;
+}
+
+void CSpectrumAnalyzer::Publish()
+{
+  // Never waits for the render thread, only the rows pushed since this slot was last published
+  // get copied
+  m_snapshots.Back().Update(m_history);
+  m_snapshots.Publish();
+}
@@ -0,0 +1,131 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include "BandKernel.h"
+#include "BandMapper.h"
+#include "ShortTimeSpectrum.h"
+#include "SpectrumHistory.h"
+#include "TripleBuffer.h"
+
+/**
+ * Everything AudioData() does, without GL nor Kodi: FFT bins to a new row of bar heights, pushed
+ * into the history, which is then published to the render thread. The FFT bins come from Kodi,
+ * with Push(), or from the built-in FFT of the PCM samples, with PushAudio().
+ *
+ * A row can also hold two grids side by side, one per stereo signal of the built-in FFT: the first
+ * one mirrored (highest band first), the second one in order, so the low bands meet in the middle.
+ *
+ * Every push also compares the new row to the one before, the histories handed over tell how
+ * many of their newest rows did not change (SteadyRows()), so the renderer can idle when nothing
+ * moves.
+ *
+ * Configure() and ConfigureSignal() are called when nothing else runs, Push(), PushAudio() and
+ * PushSilence() from the audio thread only, Snapshots() Update() and Front() from the render
+ * thread only. SetKernelParams() may be called from one other thread at any time.
+ */
+class CSpectrumAnalyzer
+{
+public:
+  /**
+   * Sizes and clears the history. Allocates only when the size changes.
+   *
+   * @param[in] bands Number of bands per grid.
+   * @param[in] depth Number of rows kept.
+   * @param[in] sampleRate Sample rate of the analysed signal, 0 for the default one.
+   * @param[in] grids 1, or 2 for mirrored stereo grids, the rows then hold 2 * bands heights.
+   */
+  void Configure(unsigned int bands, unsigned int depth, unsigned int sampleRate, unsigned int grids = 1);
+
+  /**
+   * Sets up the built-in FFT of PushAudio() and restarts it from silence, see
+   * CShortTimeSpectrum::Configure(). With two grids, they show the two signals of a stereo
+   * layout, otherwise both show the same spectrum.
+   */
+  bool ConfigureSignal(unsigned int fftSize,
+                       SpectrumWindow window,
+                       float overlap,
+                       unsigned int channels,
+                       SpectrumChannels layout = SpectrumChannels::Mono);
+
+  /**
+   * Reduction and height scale applied by the next Push() calls. They are handed over to the
+   * audio thread through a triple buffer, the next row pushed takes them.
+   */
+  void SetKernelParams(const BandKernelParams& params);
+
+  /**
+   * Pushes the bar heights of one FFT frame and publishes the history.
+   *
+   * @param[in] freqData The FFT bins, spread linearly from 0 Hz to the Nyquist frequency.
+   * @param[in] freqDataLength Number of bins, the band table is rebuilt when it changes.
+   * @param[in] time Stream time at the end of the analysed samples, in seconds.
+   * @return true if the band table was rebuilt.
+   */
+  bool Push(const float* freqData, unsigned int freqDataLength, double time);
+
+  /**
+   * Runs the built-in FFT on PCM samples, pushes the bar heights of every frame they complete,
+   * then publishes the history if anything was pushed. The rows get the stream time at the end
+   * of their FFT frame, counted in samples since ConfigureSignal().
+   *
+   * @param[in] samples Interleaved samples, with the channel count given to ConfigureSignal().
+   * @param[in] count Number of values in samples.
+   * @return true if the band table was rebuilt.
+   */
+  bool PushAudio(const float* samples, unsigned int count);
+
+  /**
+   * Pushes a row of 0 heights and publishes the history, without running the band kernel. For a
+   * block of samples found silent by MeanSquare(), and for one without FFT data, so the history
+   * keeps moving.
+   */
+  void PushSilence(double time);
+
+  /**
+   * Mean of the squared samples, 1 for a full scale square wave. Written with independent
+   * partial sums so the compiler vectorizes it, much cheaper than the band kernel.
+   */
+  static float MeanSquare(const float* samples, unsigned int count);
+
+  const CBandMapper& Mapper() const { return m_bandMapper; }
+  const CBandKernel& Kernel() const { return m_bandKernel; }
+  const CShortTimeSpectrum& Signal() const { return m_signal; }
+
+  /**
+   * Number of grids side by side in the history rows, 1 or 2.
+   */
+  unsigned int Grids() const { return m_grids; }
+
+  /**
+   * The audio thread side of the history.
+   */
+  const CSpectrumHistory& History() const { return m_history; }
+
+  /**
+   * The history copies handed over to the render thread.
+   */
+  CTripleBuffer<CSpectrumHistory>& Snapshots() { return m_snapshots; }
+
+private:
+  bool PushRow(const float* const* freqData, unsigned int signals, unsigned int freqDataLength, double time);
+  void PushConstant(float height, double time);
+  void TrackChanges();
+  void Publish();
+
+  CSpectrumHistory m_history;     // Newest row first, written by Push()
+  CTripleBuffer<CSpectrumHistory> m_snapshots;
+  CBandMapper m_bandMapper;       // FFT bins to bands table, for the current FFT length and sample rate
+  CBandKernel m_bandKernel;       // Bins to bar heights, fastest implementation for this CPU
+  BandKernelParams m_kernelParams; // The ones PushRow() uses, audio thread side
+  CTripleBuffer<BandKernelParams> m_newKernelParams; // From SetKernelParams()
+  std::vector<float> m_mirrored;  // Heights of the mirrored grid, in band order
+  unsigned int m_grids = 1;
+  CShortTimeSpectrum m_signal;    // Built-in FFT of the PCM samples
+  unsigned int m_sampleRate = CBandMapper::DEFAULT_SAMPLE_RATE;
+};
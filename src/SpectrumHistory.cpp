@@ -0,0 +1,104 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#include "SpectrumHistory.h"
+
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+
+void CSpectrumHistory::Resize(unsigned int bands, unsigned int depth)
+{
+  if (bands == 0)
+    bands = 1;
+  if (depth == 0)
+    depth = 1;
+
+  m_bands = bands;
+  m_depth = depth;
+  m_stride = (bands + ROW_ALIGNMENT_FLOATS - 1) & ~(ROW_ALIGNMENT_FLOATS - 1);
+
+  // Over-allocate by one alignment unit, the first row starts on the next 64-byte boundary
+  m_storage.assign(static_cast<size_t>(m_stride) * m_depth + ROW_ALIGNMENT_FLOATS, 0.0f);
+  uintptr_t base = reinterpret_cast<uintptr_t>(m_storage.data());
+  uintptr_t aligned = (base + ROW_ALIGNMENT - 1) & ~static_cast<uintptr_t>(ROW_ALIGNMENT - 1);
+  m_rows = m_storage.data() + (aligned - base) / sizeof(float);
+  m_times.assign(m_depth, 0.0);
+
+  m_head = 0;
+  m_pushes = 0;
+  m_steadyRows = 0;
+}
+
+CSpectrumHistory& CSpectrumHistory::operator=(const CSpectrumHistory& other)
+{
+  if (this != &other)
+    Update(other);
+  return *this;
+}
+
+void CSpectrumHistory::Clear()
+{
+  std::fill(m_storage.begin(), m_storage.end(), 0.0f);
+  std::fill(m_times.begin(), m_times.end(), 0.0);
+  m_head = 0;
+  m_pushes = 0;
+  m_steadyRows = 0;
+}
+
+float* CSpectrumHistory::Push(double time)
+{
+  m_head = (m_head + m_depth - 1) % m_depth;
+  m_pushes++;
+  m_times[m_head] = time;
+  return RowAt(m_head);
+}
+
+void CSpectrumHistory::Update(const CSpectrumHistory& source)
+{
+  unsigned int rows = source.m_pushes - m_pushes;
+
+  if (source.m_depth == 0)
+  {
+    // Never resized, nothing to copy
+    m_storage.clear();
+    m_times.clear();
+    m_rows = nullptr;
+    m_bands = m_depth = m_stride = m_head = m_pushes = m_steadyRows = 0;
+    return;
+  }
+
+  if (m_bands != source.m_bands || m_depth != source.m_depth)
+  {
+    Resize(source.m_bands, source.m_depth);
+    rows = m_depth;
+  }
+
+  if (rows >= m_depth)
+  {
+    memcpy(m_rows, source.m_rows, static_cast<size_t>(m_stride) * m_depth * sizeof(float));
+    m_times = source.m_times;
+  }
+  else
+  {
+    for (unsigned int age = 0; age < rows; age++)
+    {
+      const unsigned int row = source.PhysicalRow(age);
+      memcpy(RowAt(row), source.RowAt(row), m_stride * sizeof(float));
+      m_times[row] = source.m_times[row];
+    }
+  }
+
+  m_head = source.m_head;
+  m_pushes = source.m_pushes;
+  m_steadyRows = source.m_steadyRows;
+}
+
+void CSpectrumHistory::Push(const float* row, double time)
+{
+  memcpy(Push(time), row, m_bands * sizeof(float));
+}
@@ -0,0 +1,129 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Fixed-capacity history of spectrum rows, used as a ring buffer.
+ *
+ * Every row holds one bar height per band. Rows are stored contiguously, each one starts on a
+ * 64-byte boundary and is padded with zeros up to a multiple of 16 floats, so SIMD code can
+ * process whole rows without a scalar tail. Pushing a new row only moves the head, its cost
+ * does not depend on the history depth.
+ *
+ * Rows are addressed by age: Row(0) is the newest one, Row(Depth() - 1) the oldest one. Every row
+ * carries the time of the signal it was computed from, in seconds of audio stream.
+ *
+ * Copies can be kept up to date with Update(), which only copies the rows pushed since.
+ */
+class CSpectrumHistory
+{
+public:
+  static const size_t ROW_ALIGNMENT = 64;
+  static const size_t ROW_ALIGNMENT_FLOATS = ROW_ALIGNMENT / sizeof(float);
+
+  CSpectrumHistory() = default;
+  CSpectrumHistory(unsigned int bands, unsigned int depth) { Resize(bands, depth); }
+  CSpectrumHistory(const CSpectrumHistory& other) { *this = other; }
+  CSpectrumHistory& operator=(const CSpectrumHistory& other);
+
+  /**
+   * (Re)allocates the history storage and clears it. Not meant to be called per update.
+   *
+   * @param[in] bands Number of values per row.
+   * @param[in] depth Number of rows kept.
+   */
+  void Resize(unsigned int bands, unsigned int depth);
+
+  /**
+   * Sets every row to zero and resets the head.
+   */
+  void Clear();
+
+  /**
+   * Makes the oldest row the newest one and returns it, for the caller to fill.
+   *
+   * The padding after the first Bands() values is left untouched.
+   *
+   * @param[in] time Stream time of the row, see Time().
+   */
+  float* Push(double time = 0.0);
+
+  /**
+   * Pushes a copy of Bands() values as the newest row.
+   */
+  void Push(const float* row, double time = 0.0);
+
+  /**
+   * Makes this history a copy of "source", an older copy of it or a history of another size.
+   *
+   * Only the rows pushed to "source" since this copy was last updated are copied, unless the
+   * size differs (then it allocates) or more than Depth() rows were pushed.
+   */
+  void Update(const CSpectrumHistory& source);
+
+  /**
+   * Returns the row that was pushed "age" updates ago, 0 being the newest one.
+   */
+  float* Row(unsigned int age) { return RowAt(PhysicalRow(age)); }
+  const float* Row(unsigned int age) const { return RowAt(PhysicalRow(age)); }
+
+  /**
+   * Returns the stream time given to the row that was pushed "age" updates ago, 0 for the rows
+   * never pushed since the last Clear().
+   */
+  double Time(unsigned int age) const { return m_times[PhysicalRow(age)]; }
+
+  /**
+   * Returns the storage index of the row that was pushed "age" updates ago.
+   *
+   * The newest row is stored at Head(), the other ones follow it: (Head() + age) % Depth().
+   */
+  unsigned int PhysicalRow(unsigned int age) const { return (m_head + age) % m_depth; }
+
+  /**
+   * Returns the row stored at index "index", regardless of its age.
+   */
+  float* RowAt(unsigned int index) { return m_rows + index * m_stride; }
+  const float* RowAt(unsigned int index) const { return m_rows + index * m_stride; }
+
+  unsigned int Bands() const { return m_bands; }
+  unsigned int Depth() const { return m_depth; }
+  unsigned int Head() const { return m_head; }
+
+  /**
+   * Number of rows pushed since the last Clear() or Resize(), wraps around.
+   */
+  unsigned int Pushes() const { return m_pushes; }
+
+  /**
+   * Number of newest rows that are the same as the row pushed before them, as set by the writer
+   * with SetSteadyRows(). From Depth() - 1 on, all rows are the same and pushing another one
+   * like them does not change the history.
+   */
+  unsigned int SteadyRows() const { return m_steadyRows; }
+  void SetSteadyRows(unsigned int rows) { m_steadyRows = rows; }
+
+  /**
+   * Distance between two consecutive rows, in floats (Bands() rounded up to the SIMD padding).
+   */
+  unsigned int Stride() const { return m_stride; }
+
+private:
+  std::vector<float> m_storage;
+  std::vector<double> m_times; // Per storage row
+  float* m_rows = nullptr;
+  unsigned int m_bands = 0;
+  unsigned int m_depth = 0;
+  unsigned int m_stride = 0;
+  unsigned int m_head = 0;
+  unsigned int m_pushes = 0;
+  unsigned int m_steadyRows = 0;
+};
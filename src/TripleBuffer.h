@@ -0,0 +1,79 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+#pragma once
+
+#include <atomic>
+
+/**
+ * Wait-free handoff of the latest value from one producer thread to one consumer thread.
+ *
+ * Three slots rotate between the producer (back), the consumer (front) and a middle one that
+ * holds the last published value. Publish() and Update() are a single atomic exchange of the
+ * middle slot index, neither side ever waits for the other: the producer overwrites a value the
+ * consumer did not pick up yet, the consumer keeps its front slot until a newer value comes.
+ *
+ * The back slot is handed out in whatever state it was left, possibly two values old. The
+ * producer has to bring it up to date before publishing it.
+ */
+template<typename T>
+class CTripleBuffer
+{
+public:
+  /**
+   * Producer side: the slot to fill, then to Publish().
+   */
+  T& Back() { return m_slots[m_back]; }
+
+  /**
+   * Producer side: makes the back slot the latest value and takes another one as back slot.
+   */
+  void Publish()
+  {
+    m_back = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+  }
+
+  /**
+   * Consumer side: takes the latest published value, if any, as front slot.
+   *
+   * @return true if Front() changed.
+   */
+  bool Update()
+  {
+    if ((m_middle.load(std::memory_order_relaxed) & FRESH) == 0)
+      return false;
+
+    m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & INDEX_MASK;
+    return true;
+  }
+
+  /**
+   * Consumer side: the value taken by the last successful Update().
+   */
+  const T& Front() const { return m_slots[m_front]; }
+
+  /**
+   * Sets all slots to "value". Neither thread may use the buffer meanwhile.
+   */
+  void Reset(const T& value)
+  {
+    for (T& slot : m_slots)
+      slot = value;
+    m_back = 0;
+    m_middle.store(1, std::memory_order_release);
+    m_front = 2;
+  }
+
+private:
+  static const unsigned int INDEX_MASK = 3;
+  static const unsigned int FRESH = 4; // Set in m_middle when published and not taken yet
+
+  T m_slots[3];
+  unsigned int m_back = 0;
+  std::atomic<unsigned int> m_middle{1};
+  unsigned int m_front = 2;
+};
@@ -23,10 +23,23 @@
 #include <DirectXMath.h>
 #include <DirectXPackedVector.h>
 #include <stdio.h>
+#include <vector>
 
+#include "SpectrumHistory.h"
+#include "TripleBuffer.h"
+
+// Default grid size, the "bands" and "history_depth" settings are applied on Start()
 #define NUM_BANDS 16
+#define HISTORY_DEPTH 16
+// Every bar is written into the vertex buffer each frame, 128 x 128 of them are 16 MB of vertices.
+// That also keeps at least one of the 256 samples AudioData() looks at per band.
+#define MAX_BANDS 128
+#define MAX_HISTORY_DEPTH 128
 #define NUM_VERTICIES 36
 
+// Size of the square covered by the bar grid, whatever the number of bars
+#define GRID_SIZE 3.2f
+
 using namespace DirectX;
 using namespace DirectX::PackedVector;
 
@@ -73,8 +86,18 @@ private:
   void SetBarHeightSetting(int settingValue);
   void SetSpeedSetting(int settingValue);
   void SetModeSetting(int settingValue);
-
-  float heights[16][16], cHeights[16][16], m_scale;
+  void SetBandsSetting(int settingValue);
+  void SetHistoryDepthSetting(int settingValue);
+
+  int m_bandsSetting, m_historyDepthSetting;
+  CSpectrumHistory m_history; // History depth rows of band heights, newest first, written by AudioData()
+  CTripleBuffer<CSpectrumHistory> m_snapshots; // Copies of m_history handed over to Render()
+  std::vector<float> cHeights; // Displayed heights, same layout as m_history rows, by age
+  std::vector<int> m_xscale; // Sample range of every band, band "i" is [m_xscale[i], m_xscale[i + 1])
+  std::vector<Vertex_t> m_vertices; // Every bar of a frame, drawn with a single Draw()
+  size_t m_vBufferVertices = 0; // Size of m_vBuffer
+  float m_barWidth, m_barDepth;
+  float m_scale;
   DWORD m_mode; // D3DFILL_SOLID;
   float m_y_angle, m_y_speed, m_y_fixedAngle;
   float m_x_angle, m_x_speed;
@@ -83,7 +106,7 @@ private:
 
   void draw_vertex(Vertex_t * pVertex, float x, float y, float z, XMFLOAT4 color);
   int draw_rectangle(Vertex_t * verts, float x1, float y1, float z1, float x2, float y2, float z2, XMFLOAT4 color);
-  void draw_bar(float x_offset, float z_offset, float height, float red, float green, float blue);
+  int draw_bar(Vertex_t* verts, float x_offset, float z_offset, float height, float red, float green, float blue);
   void draw_bars(void);
   bool init_renderer_objs();
 
@@ -113,8 +136,16 @@ CVisualizationSpectrum::CVisualizationSpectrum()
     m_x_speed(0.0f),
     m_z_angle(0.0f),
     m_z_speed(0.0f),
-    m_hSpeed(0.05f)
+    m_hSpeed(0.05f),
+    m_bandsSetting(NUM_BANDS),
+    m_historyDepthSetting(HISTORY_DEPTH),
+    m_barWidth(0.1f),
+    m_barDepth(0.1f)
 {
+  SetBandsSetting(kodi::GetSettingInt("bands"));
+  SetHistoryDepthSetting(kodi::GetSettingInt("history_depth"));
+  m_history.Resize(m_bandsSetting, m_historyDepthSetting);
+
   m_context = (ID3D11DeviceContext*)Device();
   m_context->GetDevice(&m_device);
 
@@ -222,23 +253,72 @@ void CVisualizationSpectrum::Render()
       m_context->Unmap(m_cWorld, 0);
     }
 
+    // Take the latest complete history published by AudioData(), if there is a new one
+    m_snapshots.Update();
     draw_bars();
   }
 }
 
 bool CVisualizationSpectrum::Start(int iChannels, int iSamplesPerSec, int iBitsPerSample, std::string szSongName)
 {
-  int x, y;
+  int i, bands, depth;
+
+  // Everything depending on the grid size is allocated here, never per frame
+  if ((int)m_history.Bands() != m_bandsSetting || (int)m_history.Depth() != m_historyDepthSetting)
+    m_history.Resize(m_bandsSetting, m_historyDepthSetting);
+  m_history.Clear();
+  // AudioData() is not running yet, this is the only time both sides touch the snapshots
+  m_snapshots.Reset(m_history);
+
+  bands = m_history.Bands();
+  depth = m_history.Depth();
+  cHeights.assign(bands * depth, 0.0f);
+
+  // The vertex buffer only ever grows, so going back to a smaller grid does not reallocate it
+  m_vertices.resize(bands * depth * NUM_VERTICIES);
+  if (m_vBufferVertices < m_vertices.size())
+  {
+    if (m_vBuffer)
+      m_vBuffer->Release();
+    m_vBuffer = nullptr;
+    m_vBufferVertices = 0;
+    CD3D11_BUFFER_DESC desc((UINT)(sizeof(Vertex_t) * m_vertices.size()), D3D11_BIND_VERTEX_BUFFER, D3D11_USAGE_DYNAMIC, D3D11_CPU_ACCESS_WRITE);
+    if (S_OK != m_device->CreateBuffer(&desc, NULL, &m_vBuffer))
+    {
+      kodi::Log(ADDON_LOG_ERROR, "Failed to create the vertex buffer of %d x %d bars", bands, depth);
+      return false;
+    }
+    m_vBufferVertices = m_vertices.size();
+  }
 
-  for(x = 0; x < 16; x++)
+  m_xscale.resize(bands + 1);
+  if (bands == NUM_BANDS)
   {
-    for(y = 0; y < 16; y++)
+    static const int defaultScale[NUM_BANDS + 1] = {0, 1, 2, 3, 5, 7, 10, 14, 20, 28, 40, 54, 74, 101, 137, 187, 255};
+    m_xscale.assign(defaultScale, defaultScale + NUM_BANDS + 1);
+  }
+  else
+  {
+    // Same logarithmic spread as the default table, over the same 256 samples. The low bands are
+    // narrower than a sample there, each is pushed up to take at least one, and the high ones are
+    // pulled back down so the last band still ends on the last sample.
+    m_xscale[0] = 0;
+    for (i = 1; i <= bands; i++)
+    {
+      m_xscale[i] = (int)(powf(256.0f, (float)i / bands)) - 1;
+      if (m_xscale[i] <= m_xscale[i - 1])
+        m_xscale[i] = m_xscale[i - 1] + 1;
+    }
+    for (i = bands; i > 0; i--)
     {
-      heights[y][x] = 0.0f;
-      cHeights[y][x] = 0.0f;
+      if (m_xscale[i] > 256 - (bands - i))
+        m_xscale[i] = 256 - (bands - i);
     }
   }
 
+  m_barWidth = GRID_SIZE / bands / 2.0f;
+  m_barDepth = GRID_SIZE / depth / 2.0f;
+
   m_scale = 1.0f / log(256.0f);
 
   m_x_speed = 0.0f;
@@ -256,20 +336,14 @@ void CVisualizationSpectrum::AudioData(const float* pAudioData, int iAudioDataLe
   int i,c;
   int y=0;
   float val;
+  float* newRow;
 
-  int xscale[] = {0, 1, 2, 3, 5, 7, 10, 14, 20, 28, 40, 54, 74, 101, 137, 187, 255};
-
-  for(y = 15; y > 0; y--)
-  {
-    for(i = 0; i < 16; i++)
-    {
-      heights[y][i] = heights[y - 1][i];
-    }
-  }
+  // The history is a ring buffer, the oldest row is recycled as the newest one
+  newRow = m_history.Push();
 
-  for(i = 0; i < NUM_BANDS; i++)
+  for(i = 0; i < (int)m_history.Bands(); i++)
   {
-    for(c = xscale[i], y = 0; c < xscale[i + 1]; c++)
+    for(c = m_xscale[i], y = 0; c < m_xscale[i + 1]; c++)
     {
       if (c<iAudioDataLength)
       {
@@ -284,8 +358,12 @@ void CVisualizationSpectrum::AudioData(const float* pAudioData, int iAudioDataLe
       val = (logf((float)y) * m_scale);
     else
       val = 0;
-    heights[0][i] = val;
+    newRow[i] = val;
   }
+
+  // Hand the new history over to Render() without waiting for it
+  m_snapshots.Back().Update(m_history);
+  m_snapshots.Publish();
 }
 
 void CVisualizationSpectrum::SetBarHeightSetting(int settingValue)
@@ -354,6 +432,13 @@ void CVisualizationSpectrum::SetModeSetting(int settingValue)
     m_mode = 1; // D3DFILL_POINT;
     break;
 
+  case 3:
+  case 4:
+    // The surface and the waterfall are drawn by the OpenGL renderer only, the same grid is shown as bars here
+    kodi::Log(ADDON_LOG_INFO, "The %s mode needs OpenGL, drawing solid bars instead", settingValue == 3 ? "surface" : "waterfall");
+    m_mode = 3; // D3DFILL_SOLID;
+    break;
+
   case 0:
   default:
     m_mode = 3; // D3DFILL_SOLID;
@@ -361,6 +446,34 @@ void CVisualizationSpectrum::SetModeSetting(int settingValue)
   }
 }
 
+void CVisualizationSpectrum::SetBandsSetting(int settingValue)
+{
+  // Applied on the next Start(), where the buffers are allocated
+  if (settingValue < NUM_BANDS)
+    m_bandsSetting = NUM_BANDS;
+  else if (settingValue > MAX_BANDS)
+  {
+    kodi::Log(ADDON_LOG_INFO, "%d bands are more than DirectX draws, using %d", settingValue, MAX_BANDS);
+    m_bandsSetting = MAX_BANDS;
+  }
+  else
+    m_bandsSetting = settingValue;
+}
+
+void CVisualizationSpectrum::SetHistoryDepthSetting(int settingValue)
+{
+  // Applied on the next Start(), where the buffers are allocated
+  if (settingValue < HISTORY_DEPTH)
+    m_historyDepthSetting = HISTORY_DEPTH;
+  else if (settingValue > MAX_HISTORY_DEPTH)
+  {
+    kodi::Log(ADDON_LOG_INFO, "%d rows of history are more than DirectX draws, using %d", settingValue, MAX_HISTORY_DEPTH);
+    m_historyDepthSetting = MAX_HISTORY_DEPTH;
+  }
+  else
+    m_historyDepthSetting = settingValue;
+}
+
 //-- SetSetting ---------------------------------------------------------------
 // Set a specific Setting value (called from XBMC)
 // !!! Add-on master function !!!
@@ -390,6 +503,16 @@ ADDON_STATUS CVisualizationSpectrum::SetSetting(const std::string& settingName,
     m_y_fixedAngle = settingValue.GetInt();
     return ADDON_STATUS_OK;
   }
+  else if (settingName == "bands")
+  {
+    SetBandsSetting(settingValue.GetInt());
+    return ADDON_STATUS_OK;
+  }
+  else if (settingName == "history_depth")
+  {
+    SetHistoryDepthSetting(settingValue.GetInt());
+    return ADDON_STATUS_OK;
+  }
 
   return ADDON_STATUS_UNKNOWN;
 }
@@ -425,12 +548,12 @@ int CVisualizationSpectrum::draw_rectangle(Vertex_t * verts, float x1, float y1,
   return 6;
 }
 
-void CVisualizationSpectrum::draw_bar(float x_offset, float z_offset, float height, float red, float green, float blue)
+int CVisualizationSpectrum::draw_bar(Vertex_t* verts, float x_offset, float z_offset, float height, float red, float green, float blue)
 {
-  Vertex_t  verts[NUM_VERTICIES];
   int verts_idx = 0;
 
-  float width = 0.1f;
+  float width = m_barWidth;
+  float depth = m_barDepth;
   XMFLOAT4 color;
 
   if (1 == m_mode /*== D3DFILL_POINT*/)
@@ -439,62 +562,76 @@ void CVisualizationSpectrum::draw_bar(float x_offset, float z_offset, float heig
   if (1 != m_mode /*!= D3DFILL_POINT*/)
   {
     color = XMFLOAT4(red, green, blue, 1.0f);
-    verts_idx += draw_rectangle(&verts[verts_idx], x_offset, height, z_offset, x_offset + width, height, z_offset + 0.1f, color);
+    verts_idx += draw_rectangle(&verts[verts_idx], x_offset, height, z_offset, x_offset + width, height, z_offset + depth, color);
   }
-  verts_idx += draw_rectangle(&verts[verts_idx], x_offset, 0.0f, z_offset, x_offset + width, 0.0f, z_offset + 0.1f, color);
+  verts_idx += draw_rectangle(&verts[verts_idx], x_offset, 0.0f, z_offset, x_offset + width, 0.0f, z_offset + depth, color);
 
   if (1 != m_mode /*!= D3DFILL_POINT*/)
   {
     color = XMFLOAT4(0.5f * red, 0.5f * green, 0.5f * blue, 1.0f);
-    verts_idx += draw_rectangle(&verts[verts_idx], x_offset, 0.0f, z_offset + 0.1f, x_offset + width, height, z_offset + 0.1f, color);
+    verts_idx += draw_rectangle(&verts[verts_idx], x_offset, 0.0f, z_offset + depth, x_offset + width, height, z_offset + depth, color);
   }
   verts_idx += draw_rectangle(&verts[verts_idx], x_offset, 0.0f, z_offset, x_offset + width, height, z_offset, color);
 
   if (1 != m_mode /*!= D3DFILL_POINT*/)
   {
     color = XMFLOAT4(0.25f * red, 0.25f * green, 0.25f * blue, 1.0f);
-    verts_idx += draw_rectangle(&verts[verts_idx], x_offset, 0.0f, z_offset , x_offset, height, z_offset + 0.1f, color);
+    verts_idx += draw_rectangle(&verts[verts_idx], x_offset, 0.0f, z_offset , x_offset, height, z_offset + depth, color);
   }
-  verts_idx += draw_rectangle(&verts[verts_idx], x_offset + width, 0.0f, z_offset , x_offset + width, height, z_offset + 0.1f, color);
+  verts_idx += draw_rectangle(&verts[verts_idx], x_offset + width, 0.0f, z_offset , x_offset + width, height, z_offset + depth, color);
 
-  D3D11_MAPPED_SUBRESOURCE res;
-  if (S_OK == m_context->Map(m_vBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &res))
-  {
-    memcpy(res.pData, verts, sizeof(Vertex_t) * NUM_VERTICIES);
-    m_context->Unmap(m_vBuffer, 0);
-  }
-
-  m_context->IASetPrimitiveTopology(m_mode != 1 /*D3DFILL_POINT*/ ? D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST : D3D11_PRIMITIVE_TOPOLOGY_POINTLIST);
-  m_context->Draw(verts_idx, 0);
+  return verts_idx;
 }
 
 void CVisualizationSpectrum::draw_bars(void)
 {
   int x,y;
   float x_offset, z_offset, r_base, b_base;
+  const CSpectrumHistory& history = m_snapshots.Front();
+  const int bands = history.Bands();
+  const int depth = history.Depth();
+  const float last_band = (float)(bands - 1);
+  int verts_idx = 0;
 
-  for(y = 0; y < 16; y++)
+  if (m_vertices.size() < (size_t)(bands * depth * NUM_VERTICIES) || m_vBufferVertices < m_vertices.size())
+    return;
+
+  for(y = 0; y < depth; y++)
   {
-    z_offset = -1.6f + ((15 - y) * 0.2f);
+    const float* heights = history.Row(y);
+    float* current = &cHeights[y * bands];
+
+    z_offset = -GRID_SIZE / 2.0f + ((depth - 1 - y) * (GRID_SIZE / depth));
 
-    b_base = y * (1.0f / 15);
+    b_base = y * (1.0f / (depth - 1));
     r_base = 1.0f - b_base;
 
-    for(x = 0; x < 16; x++)
+    for(x = 0; x < bands; x++)
     {
-      x_offset = -1.6f + (x * 0.2f);
-      if (::fabs(cHeights[y][x]-heights[y][x])>m_hSpeed)
+      x_offset = -GRID_SIZE / 2.0f + (x * (GRID_SIZE / bands));
+      if (::fabs(current[x]-heights[x])>m_hSpeed)
       {
-        if (cHeights[y][x]<heights[y][x])
-          cHeights[y][x] += m_hSpeed;
+        if (current[x]<heights[x])
+          current[x] += m_hSpeed;
         else
-          cHeights[y][x] -= m_hSpeed;
+          current[x] -= m_hSpeed;
       }
-      draw_bar(x_offset, z_offset,
-               cHeights[y][x], r_base - (x * (r_base / 15.0f)),
-               x * (1.0f / 15), b_base);
+      verts_idx += draw_bar(&m_vertices[verts_idx], x_offset, z_offset,
+                            current[x], r_base - (x * (r_base / last_band)),
+                            x * (1.0f / last_band), b_base);
     }
   }
+
+  // One upload and one draw for the whole grid, not one per bar
+  D3D11_MAPPED_SUBRESOURCE res;
+  if (S_OK == m_context->Map(m_vBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &res))
+  {
+    memcpy(res.pData, m_vertices.data(), sizeof(Vertex_t) * verts_idx);
+    m_context->Unmap(m_vBuffer, 0);
+  }
+
+  m_context->IASetPrimitiveTopology(m_mode != 1 /*D3DFILL_POINT*/ ? D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST : D3D11_PRIMITIVE_TOPOLOGY_POINTLIST);
+  m_context->Draw(verts_idx, 0);
 }
 
 bool CVisualizationSpectrum::init_renderer_objs()
@@ -519,6 +656,7 @@ bool CVisualizationSpectrum::init_renderer_objs()
   CD3D11_BUFFER_DESC desc(sizeof(Vertex_t) * NUM_VERTICIES, D3D11_BIND_VERTEX_BUFFER, D3D11_USAGE_DYNAMIC, D3D11_CPU_ACCESS_WRITE);
   if (S_OK != m_device->CreateBuffer(&desc, NULL, &m_vBuffer))
     return false;
+  m_vBufferVertices = NUM_VERTICIES;
 
   desc.ByteWidth = sizeof(cbWorld);
   desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
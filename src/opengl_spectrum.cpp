@@ -30,8 +30,25 @@
  */
 
 /* MACRO DEFINES */
-/* Defines the number of bars to display in the X and Y planes, uses the same number for both. */
+/* Defines the default number of bars to display in the X (bands) and Y (history depth) planes. */
+/* Both are runtime settings ("bands" and "history_depth"), applied on Start(). */
 #define NUM_BARS  (16U)
+#define MAX_BANDS (512U)
+#define MAX_HISTORY_DEPTH (512U)
+#define MIN_FFT_SIZE (512U)     // Built-in FFT lengths of the "fft_size" setting: 512 << value
+#define MAX_FFT_SIZE (16384U)
+
+/* Longest time between two spectra the bars glide over, longer gaps are shown as steps. */
+#define MAX_ROW_INTERVAL (0.5f)
+
+/* Mean square of the samples below which a block is silent, -90 dBFS. */
+#define SILENCE_LEVEL (1e-9f)
+
+/* Time between two summaries of the "profiling" setting in the debug log, in seconds. */
+#define PROFILE_LOG_INTERVAL (10.0f)
+
+/* Size of the square covered by the bar grid, in model units, whatever the number of bars. */
+#define GRID_SIZE (3.2f)
 
 
 
@@ -68,25 +85,1103 @@
 /* INCLUDES */
 #include <kodi/addon-instance/Visualization.h>
 #include <kodi/gui/gl/GL.h>
-#include <kodi/gui/gl/Shader.h>
 
 #include <string.h>
 #include <math.h>
 #include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstddef>
+#include <vector>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "BarColors.h"
+#include "FrameProfiler.h"
+#include "GLProgram.h"
+#include "QualityGovernor.h"
+#include "SpectrumAnalyzer.h"
+
+/* Desktop GL and GLES 3.0 draw the whole bar grid with a single instanced draw call. */
+/* GLES 2.0 has no instancing, it draws a static mesh of GLES2_BATCH_BARS bars once per batch of bars. */
+#if defined(HAS_GL) || (defined(HAS_GLES) && (HAS_GLES >= 3))
+#define SPECTRUM_INSTANCING
+#define SPECTRUM_SHADER_DIR "resources/shaders/" GL_TYPE_STRING "/"
+#else
+#define SPECTRUM_SHADER_DIR "resources/shaders/GLES2/"
+/* Bars whose heights fit in the u_heights uniform array of the GLES 2.0 vertex shader, 4 per vector. */
+#define GLES2_BATCH_BARS (256U)
+#endif
+
+/* Unit bar mesh, one per instance, scaled to the bar size and height in the vertex shader. */
+/* Each vertex is { x, y, z, shade }, where "shade" is the face multiplier used in filled mode. */
+/* Every face has its own 4 corners, as the shade is per face. The camera never looks up at the */
+/* grid, so there is no bottom face. The last vertex is the center of the top, the only one drawn */
+/* in point mode. */
+static const GLfloat unitBarMesh[21][4] =
+{
+  // Sides
+  { 0.0f, 0.0f, 0.0f, 0.5f }, { 0.0f, 0.0f, 1.0f, 0.5f }, { 0.0f, 1.0f, 1.0f, 0.5f }, { 0.0f, 1.0f, 0.0f, 0.5f },
+  { 0.0f, 0.0f, 0.0f, 0.25f }, { 0.0f, 1.0f, 0.0f, 0.25f }, { 1.0f, 1.0f, 0.0f, 0.25f }, { 1.0f, 0.0f, 0.0f, 0.25f },
+  { 0.0f, 0.0f, 1.0f, 0.75f }, { 1.0f, 0.0f, 1.0f, 0.75f }, { 1.0f, 1.0f, 1.0f, 0.75f }, { 0.0f, 1.0f, 1.0f, 0.75f },
+  { 1.0f, 0.0f, 0.0f, 0.5f }, { 1.0f, 1.0f, 0.0f, 0.5f }, { 1.0f, 1.0f, 1.0f, 0.5f }, { 1.0f, 0.0f, 1.0f, 0.5f },
+
+  // Top
+  { 0.0f, 1.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 1.0f, 1.0f }, { 1.0f, 1.0f, 1.0f, 1.0f }, { 1.0f, 1.0f, 0.0f, 1.0f },
+
+  // Top center
+  { 0.5f, 1.0f, 0.5f, 1.0f }
+};
+#define BAR_MESH_VERTICES (sizeof(unitBarMesh) / sizeof(unitBarMesh[0]))
+#define BAR_POINT_VERTEX (20U)
+
+/* Two triangles per face, counter-clockwise seen from outside the bar, so back faces can be culled. */
+/* The sides between neighbouring bands come first, the reduced face detail leaves them out. */
+static const GLubyte unitBarIndices[30] =
+{
+  0, 1, 2, 0, 2, 3,
+  12, 13, 14, 12, 14, 15,
+  4, 5, 6, 4, 6, 7,
+  8, 9, 10, 8, 10, 11,
+  16, 17, 18, 16, 18, 19
+};
+#define BAR_MESH_INDICES (sizeof(unitBarIndices) / sizeof(unitBarIndices[0]))
+#define BAR_REDUCED_INDICES (18U) // The last ones
+
+/* The 12 edges of the bar, in wireframe mode: bottom, top, then the vertical ones. */
+static const GLubyte unitBarEdges[24] =
+{
+  0, 1, 1, 9, 9, 7, 7, 0,
+  16, 17, 17, 18, 18, 19, 19, 16,
+  0, 16, 1, 17, 9, 18, 7, 19
+};
+#define BAR_EDGE_INDICES (sizeof(unitBarEdges) / sizeof(unitBarEdges[0]))
+
+#ifndef SPECTRUM_INSTANCING
+/* Vertex of the static GLES 2.0 batch mesh: the unit bar mesh, once per bar of a batch. */
+/* "bar" indexes the height of the bar in u_heights, within its batch of GLES2_BATCH_BARS bars. */
+struct BarVertex
+{
+  GLfloat x, y, z;
+  GLubyte shade; // Normalized
+  GLubyte bar;
+  GLubyte padding[2];
+};
+#endif
+
+#ifdef SPECTRUM_INSTANCING
+/**
+ * Attack and release smoothing of the bar heights, evaluated on the GPU.
+ *
+ * The height shown for every bar is kept in a bands x depth float texture, in grid order (row 0
+ * being the newest one). Each frame, one pass over that texture moves every height towards the
+ * one at the same grid position in the history texture, ping-ponging between two textures:
+ *   shown += (target - shown) * mix
+ * "mix" being 1 - exp(-elapsed / attack time) when rising, the same with the release time when
+ * falling. The CPU cost is two uniforms and one quad, whatever the grid size.
+ */
+class ATTRIBUTE_HIDDEN CHeightSmoother : public CGLProgram
+{
+public:
+  ~CHeightSmoother() override { Destroy(); }
+
+  bool Create(unsigned int bands, unsigned int depth);
+  void Destroy();
+  bool IsCreated() const { return m_framebuffers[0] != 0; }
+
+  /**
+   * Brings the heights back to zero, for a new song.
+   */
+  void Clear();
+
+  /**
+   * Runs the smoothing pass and returns the texture of the heights to show, in grid order.
+   *
+   * @param[in] history The history texture, a ring starting at row "head".
+   * @param[in] head Storage row of the newest history row.
+   * @param[in] attackMix Part of the distance to a higher target covered by this frame.
+   * @param[in] releaseMix Part of the distance to a lower target covered by this frame.
+   * @param[in] rowBlend Weight of the newest history row against the one before, see Render().
+   */
+  GLuint Update(GLuint history, int head, float attackMix, float releaseMix, float rowBlend);
+
+  void OnCompiledAndLinked() override;
+  bool OnEnabled() override;
+
+private:
+  GLuint m_textures[2] = {0, 0};
+  GLuint m_framebuffers[2] = {0, 0}; // m_framebuffers[i] renders into m_textures[i]
+  unsigned int m_current = 0;        // Texture holding the heights of the last frame
+  unsigned int m_bands = 0;
+  unsigned int m_depth = 0;
+
+  int m_head = 0;
+  float m_attackMix = 1.0f;
+  float m_releaseMix = 1.0f;
+  float m_rowBlend = 1.0f;
+
+  GLint m_uHistory = -1;
+  GLint m_uHistoryHead = -1;
+  GLint m_uHistoryDepth = -1;
+  GLint m_uShown = -1;
+  GLint m_uAttackMix = -1;
+  GLint m_uReleaseMix = -1;
+  GLint m_uRowBlend = -1;
+};
+
+/**
+ * Loads the smoothing shaders and allocates the two height textures, cleared to zero.
+ *
+ * Called from Start() when the grid size changes. Fails on GLES when float textures cannot be
+ * rendered to, the bars are then drawn without smoothing.
+ */
+bool CHeightSmoother::Create(unsigned int bands, unsigned int depth)
+{
+  Destroy();
+
+#if defined(HAS_GLES)
+  bool floatTargets = false;
+  GLint extensions = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+  for (GLint i = 0; i < extensions && !floatTargets; i++)
+    floatTargets = strcmp(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)), "GL_EXT_color_buffer_float") == 0;
+  if (!floatTargets)
+  {
+    kodi::Log(ADDON_LOG_DEBUG, "GL_EXT_color_buffer_float is missing, bar heights are not smoothed");
+    return false;
+  }
+#endif
+
+  if (!Load(SPECTRUM_SHADER_DIR "smooth_vert.glsl", SPECTRUM_SHADER_DIR "smooth_frag.glsl"))
+  {
+    kodi::Log(ADDON_LOG_ERROR, "Failed to create or compile the smoothing shader");
+    return false;
+  }
+
+  const std::vector<GLfloat> zeros(bands * depth, 0.0f);
+  GLint previousFramebuffer = 0;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+  glGenTextures(2, m_textures);
+  glGenFramebuffers(2, m_framebuffers);
+
+  bool complete = true;
+  for (int i = 0; i < 2; i++)
+  {
+    glBindTexture(GL_TEXTURE_2D, m_textures[i]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, bands, depth, 0, GL_RED, GL_FLOAT, zeros.data());
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffers[i]);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_textures[i], 0);
+    complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+
+  if (!complete)
+  {
+    kodi::Log(ADDON_LOG_ERROR, "Float framebuffers are not supported, bar heights are not smoothed");
+    Destroy();
+    return false;
+  }
+
+  m_current = 0;
+  m_bands = bands;
+  m_depth = depth;
+  return true;
+}
+
+void CHeightSmoother::Destroy()
+{
+  if (!IsCreated())
+    return;
+
+  glDeleteFramebuffers(2, m_framebuffers);
+  glDeleteTextures(2, m_textures);
+  m_framebuffers[0] = m_framebuffers[1] = 0;
+  m_textures[0] = m_textures[1] = 0;
+}
+
+void CHeightSmoother::Clear()
+{
+  if (!IsCreated())
+    return;
+
+  GLint previousFramebuffer = 0;
+  GLfloat clearColor[4];
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+  glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+  const GLboolean scissor = glIsEnabled(GL_SCISSOR_TEST);
+  glDisable(GL_SCISSOR_TEST);
+
+  glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+  for (int i = 0; i < 2; i++)
+  {
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffers[i]);
+    glClear(GL_COLOR_BUFFER_BIT);
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+  glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+  if (scissor)
+    glEnable(GL_SCISSOR_TEST);
+}
+
+GLuint CHeightSmoother::Update(GLuint history, int head, float attackMix, float releaseMix, float rowBlend)
+{
+  // Kodi may render into its own framebuffer, with a scissor box around the visualization
+  GLint previousFramebuffer = 0;
+  GLint viewport[4];
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  const GLboolean scissor = glIsEnabled(GL_SCISSOR_TEST);
+  glDisable(GL_SCISSOR_TEST);
+
+  const unsigned int next = 1 - m_current;
+  glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffers[next]);
+  glViewport(0, 0, m_bands, m_depth);
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, history);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, m_textures[m_current]);
+
+  m_head = head;
+  m_attackMix = attackMix;
+  m_releaseMix = releaseMix;
+  m_rowBlend = rowBlend;
+  EnableShader();
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  DisableShader();
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+  if (scissor)
+    glEnable(GL_SCISSOR_TEST);
+
+  m_current = next;
+  return m_textures[m_current];
+}
+
+void CHeightSmoother::OnCompiledAndLinked()
+{
+  m_uHistory = glGetUniformLocation(ProgramHandle(), "u_history");
+  m_uHistoryHead = glGetUniformLocation(ProgramHandle(), "u_historyHead");
+  m_uHistoryDepth = glGetUniformLocation(ProgramHandle(), "u_historyDepth");
+  m_uShown = glGetUniformLocation(ProgramHandle(), "u_shown");
+  m_uAttackMix = glGetUniformLocation(ProgramHandle(), "u_attackMix");
+  m_uReleaseMix = glGetUniformLocation(ProgramHandle(), "u_releaseMix");
+  m_uRowBlend = glGetUniformLocation(ProgramHandle(), "u_rowBlend");
+}
+
+bool CHeightSmoother::OnEnabled()
+{
+  glUniform1i(m_uHistory, 0);
+  glUniform1i(m_uHistoryHead, m_head);
+  glUniform1i(m_uHistoryDepth, m_depth);
+  glUniform1i(m_uShown, 1);
+  glUniform1f(m_uAttackMix, m_attackMix);
+  glUniform1f(m_uReleaseMix, m_releaseMix);
+  glUniform1f(m_uRowBlend, m_rowBlend);
+  return true;
+}
+
+/**
+ * The history as one continuous heightfield, the "surface" mode.
+ *
+ * One vertex per band and per history row, over the center of the bar the other modes draw
+ * there. The mesh only holds the (band, age) cell of every vertex and is built once; the vertex
+ * shader fetches the height of its cell from the same texture as the bars, and shades it with a
+ * normal from the heights of the four neighbouring cells. The rows are joined into one triangle
+ * strip by degenerate triangles, newest row first, so the whole surface is one draw call and the
+ * newest rows alone are a shorter one.
+ */
+class ATTRIBUTE_HIDDEN CSurfaceMesh : public CGLProgram
+{
+public:
+  ~CSurfaceMesh() override { Destroy(); }
+
+  bool Create(unsigned int bands, unsigned int depth);
+  void Destroy();
+  bool IsCreated() const { return m_vao != 0; }
+
+  /**
+   * Draws the newest "rows" rows of the surface, with depth testing on and the matrices set.
+   *
+   * @param[in] heights Texture of the heights, a ring starting at row "head".
+   * @param[in] head Storage row of the newest row.
+   * @param[in] rowBlend Weight of the newest row against the one before, see Render().
+   * @param[in] gridBands Bands of one grid, see CSpectrumAnalyzer::Grids().
+   * @param[in] rows Rows to draw, at least 2.
+   * @param[in] palette The bar palette texture.
+   */
+  void Draw(const glm::mat4& projection, const glm::mat4& modelView, GLuint heights, int head, float rowBlend,
+            unsigned int gridBands, unsigned int rows, GLuint palette);
+
+  void OnCompiledAndLinked() override;
+  bool OnEnabled() override;
+
+private:
+  // Indices of the first "rows" rows
+  static GLsizei StripIndices(unsigned int bands, unsigned int rows) { return (rows - 1) * (2 * bands + 2) - 2; }
+
+  GLuint m_vao = 0;
+  GLuint m_cellVBO = 0;
+  GLuint m_stripIBO = 0;
+  unsigned int m_bands = 0;
+  unsigned int m_depth = 0;
+
+  glm::mat4 m_projection;
+  glm::mat4 m_modelView;
+  int m_head = 0;
+  float m_rowBlend = 1.0f;
+  unsigned int m_gridBands = 1;
+
+  GLint m_uProjMatrix = -1;
+  GLint m_uModelMatrix = -1;
+  GLint m_uHistory = -1;
+  GLint m_uHistoryHead = -1;
+  GLint m_uHistoryDepth = -1;
+  GLint m_uBands = -1;
+  GLint m_uGridBands = -1;
+  GLint m_uRowBlend = -1;
+  GLint m_uGridSize = -1;
+  GLint m_uPalette = -1;
+  GLint m_hCell = -1;
+};
+
+/**
+ * Loads the surface shaders and builds the mesh of a bands x depth grid.
+ *
+ * Called from Render() the first time the surface is drawn, and again after the grid size changed.
+ * A grid of a single band or row has no surface, the bars are drawn instead.
+ */
+bool CSurfaceMesh::Create(unsigned int bands, unsigned int depth)
+{
+  Destroy();
+  if (bands < 2 || depth < 2)
+    return false;
+
+  if (!Load(SPECTRUM_SHADER_DIR "surface_vert.glsl", SPECTRUM_SHADER_DIR "frag.glsl"))
+  {
+    kodi::Log(ADDON_LOG_ERROR, "Failed to create or compile the surface shader");
+    return false;
+  }
+
+  // Row after row, the newest first
+  std::vector<GLushort> cells(bands * depth * 2);
+  for (unsigned int age = 0; age < depth; age++)
+  {
+    for (unsigned int band = 0; band < bands; band++)
+    {
+      cells[(age * bands + band) * 2] = static_cast<GLushort>(band);
+      cells[(age * bands + band) * 2 + 1] = static_cast<GLushort>(age);
+    }
+  }
+
+  // Zig-zag between a row and the next older one, then repeat the last vertex and the first of the
+  // next pair of rows: four degenerate triangles which keep the strip going
+  std::vector<GLuint> indices;
+  indices.reserve(StripIndices(bands, depth));
+  for (unsigned int age = 0; age + 1 < depth; age++)
+  {
+    if (age > 0)
+    {
+      const GLuint last = indices.back();
+      indices.push_back(last);
+      indices.push_back(age * bands);
+    }
+    for (unsigned int band = 0; band < bands; band++)
+    {
+      indices.push_back(age * bands + band);
+      indices.push_back((age + 1) * bands + band);
+    }
+  }
+
+  GLint previousVAO = 0;
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVAO);
+  glGenVertexArrays(1, &m_vao);
+  glGenBuffers(1, &m_cellVBO);
+  glGenBuffers(1, &m_stripIBO);
+  glBindVertexArray(m_vao);
+  glBindBuffer(GL_ARRAY_BUFFER, m_cellVBO);
+  glBufferData(GL_ARRAY_BUFFER, cells.size() * sizeof(GLushort), cells.data(), GL_STATIC_DRAW);
+  glVertexAttribPointer(m_hCell, 2, GL_UNSIGNED_SHORT, GL_FALSE, 0, nullptr);
+  glEnableVertexAttribArray(m_hCell);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_stripIBO);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+  glBindVertexArray(previousVAO);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  m_bands = bands;
+  m_depth = depth;
+  return true;
+}
+
+void CSurfaceMesh::Destroy()
+{
+  if (!IsCreated())
+    return;
+
+  glDeleteVertexArrays(1, &m_vao);
+  glDeleteBuffers(1, &m_cellVBO);
+  glDeleteBuffers(1, &m_stripIBO);
+  m_vao = 0;
+  m_cellVBO = 0;
+  m_stripIBO = 0;
+}
+
+void CSurfaceMesh::Draw(const glm::mat4& projection, const glm::mat4& modelView, GLuint heights, int head, float rowBlend,
+                        unsigned int gridBands, unsigned int rows, GLuint palette)
+{
+  rows = std::min(std::max(rows, 2U), m_depth);
+
+  GLint previousVAO = 0;
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVAO);
+  glBindVertexArray(m_vao);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, palette);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, heights);
+
+  m_projection = projection;
+  m_modelView = modelView;
+  m_head = head;
+  m_rowBlend = rowBlend;
+  m_gridBands = gridBands;
+  EnableShader();
+  glDrawElements(GL_TRIANGLE_STRIP, StripIndices(m_bands, rows), GL_UNSIGNED_INT, nullptr);
+  DisableShader();
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+  glBindVertexArray(previousVAO);
+}
+
+void CSurfaceMesh::OnCompiledAndLinked()
+{
+  m_uProjMatrix = glGetUniformLocation(ProgramHandle(), "u_projectionMatrix");
+  m_uModelMatrix = glGetUniformLocation(ProgramHandle(), "u_modelViewMatrix");
+  m_uHistory = glGetUniformLocation(ProgramHandle(), "u_history");
+  m_uHistoryHead = glGetUniformLocation(ProgramHandle(), "u_historyHead");
+  m_uHistoryDepth = glGetUniformLocation(ProgramHandle(), "u_historyDepth");
+  m_uBands = glGetUniformLocation(ProgramHandle(), "u_bands");
+  m_uGridBands = glGetUniformLocation(ProgramHandle(), "u_gridBands");
+  m_uRowBlend = glGetUniformLocation(ProgramHandle(), "u_rowBlend");
+  m_uGridSize = glGetUniformLocation(ProgramHandle(), "u_gridSize");
+  m_uPalette = glGetUniformLocation(ProgramHandle(), "u_palette");
+  m_hCell = glGetAttribLocation(ProgramHandle(), "a_cell");
+}
+
+bool CSurfaceMesh::OnEnabled()
+{
+  glUniformMatrix4fv(m_uProjMatrix, 1, GL_FALSE, glm::value_ptr(m_projection));
+  glUniformMatrix4fv(m_uModelMatrix, 1, GL_FALSE, glm::value_ptr(m_modelView));
+  glUniform1i(m_uHistory, 0);
+  glUniform1i(m_uHistoryHead, m_head);
+  glUniform1i(m_uHistoryDepth, m_depth);
+  glUniform1i(m_uBands, m_bands);
+  glUniform1i(m_uGridBands, m_gridBands);
+  glUniform1f(m_uRowBlend, m_rowBlend);
+  glUniform1f(m_uGridSize, GRID_SIZE);
+  glUniform1i(m_uPalette, 1);
+  return true;
+}
+#endif
+
+/**
+ * Copy of the last frame, drawn again instead of the scene while nothing moves.
+ *
+ * Capture() copies the viewport of the current framebuffer into a texture, Draw() covers the
+ * viewport with it: one textured quad instead of the whole grid. Multisampled framebuffers
+ * cannot be copied from, nothing is cached then and the scene keeps being rendered.
+ *
+ * Capture() can also copy the bottom left part of the viewport only, Draw() then stretches it
+ * over the whole viewport: the reduced render scales of CQualityGovernor.
+ */
+class ATTRIBUTE_HIDDEN CFrameCache : public CGLProgram
+{
+public:
+  ~CFrameCache() override { Destroy(); }
+
+  bool Create();
+  void Destroy();
+  bool IsCreated() const { return m_texture != 0; }
+
+  /**
+   * @return false if the current framebuffer cannot be copied from.
+   */
+  bool CanCapture() const;
+
+  /**
+   * Size of the part of the viewport Capture() copies at a render scale.
+   */
+  static GLsizei Scaled(GLsizei size, float scale) { return std::max(1, static_cast<GLsizei>(lroundf(size * scale))); }
+
+  /**
+   * @param[in] key Changes whenever something besides the bar heights changes the scene.
+   * @return true if the copy was made with this key and the current viewport.
+   */
+  bool IsValidFor(unsigned int key) const;
+
+  /**
+   * Copies the viewport, or its bottom left "scale" part, once the scene is drawn.
+   */
+  void Capture(unsigned int key, float scale = 1.0f);
+  void Invalidate() { m_valid = false; }
+
+  /**
+   * Draws the copy back, blending and depth testing must be off.
+   */
+  void Draw();
+
+  void OnCompiledAndLinked() override;
+  bool OnEnabled() override;
+
+private:
+  GLuint m_texture = 0;
+  GLuint m_quadVBO = 0;
+#ifdef SPECTRUM_INSTANCING
+  GLuint m_vao = 0;
+#endif
+  GLint m_viewport[4] = {0, 0, 0, 0}; // Viewport of the copy
+  GLsizei m_width = 0;                // Texture size, the copied part of the viewport
+  GLsizei m_height = 0;
+  unsigned int m_key = 0;
+  bool m_valid = false;
+
+  GLint m_uFrame = -1;
+  GLint m_hPosition = -1;
+};
+
+/**
+ * Loads the copy shaders and creates the quad, the texture is sized by the first Capture().
+ *
+ * Called once, by the first Start().
+ */
+bool CFrameCache::Create()
+{
+  Destroy();
+
+  if (!Load(SPECTRUM_SHADER_DIR "frame_vert.glsl", SPECTRUM_SHADER_DIR "frame_frag.glsl"))
+  {
+    kodi::Log(ADDON_LOG_ERROR, "Failed to create or compile the frame copy shader");
+    return false;
+  }
+
+  static const GLfloat quad[4][2] = { { -1.0f, -1.0f }, { 1.0f, -1.0f }, { -1.0f, 1.0f }, { 1.0f, 1.0f } };
+  glGenBuffers(1, &m_quadVBO);
+  glBindBuffer(GL_ARRAY_BUFFER, m_quadVBO);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+#ifdef SPECTRUM_INSTANCING
+  GLint previousVAO = 0;
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVAO);
+  glGenVertexArrays(1, &m_vao);
+  glBindVertexArray(m_vao);
+  glVertexAttribPointer(m_hPosition, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+  glEnableVertexAttribArray(m_hPosition);
+  glBindVertexArray(previousVAO);
+#endif
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  glGenTextures(1, &m_texture);
+  glBindTexture(GL_TEXTURE_2D, m_texture);
+  // Texel centers at full scale, so this only makes a difference when stretching
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  m_width = m_height = 0;
+  m_valid = false;
+  return true;
+}
+
+void CFrameCache::Destroy()
+{
+  if (!IsCreated())
+    return;
+
+#ifdef SPECTRUM_INSTANCING
+  glDeleteVertexArrays(1, &m_vao);
+  m_vao = 0;
+#endif
+  glDeleteBuffers(1, &m_quadVBO);
+  glDeleteTextures(1, &m_texture);
+  m_quadVBO = 0;
+  m_texture = 0;
+  m_valid = false;
+}
+
+bool CFrameCache::CanCapture() const
+{
+  GLint sampleBuffers = 0;
+  glGetIntegerv(GL_SAMPLE_BUFFERS, &sampleBuffers);
+  return IsCreated() && sampleBuffers == 0;
+}
+
+bool CFrameCache::IsValidFor(unsigned int key) const
+{
+  if (!m_valid || key != m_key)
+    return false;
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  return memcmp(viewport, m_viewport, sizeof(viewport)) == 0;
+}
+
+void CFrameCache::Capture(unsigned int key, float scale)
+{
+  m_valid = false;
+  if (!IsCreated())
+    return;
+
+  GLint sampleBuffers = 0;
+  glGetIntegerv(GL_SAMPLE_BUFFERS, &sampleBuffers);
+  glGetIntegerv(GL_VIEWPORT, m_viewport);
+  if (sampleBuffers > 0 || m_viewport[2] <= 0 || m_viewport[3] <= 0)
+    return;
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_texture);
+  const GLsizei width = Scaled(m_viewport[2], scale);
+  const GLsizei height = Scaled(m_viewport[3], scale);
+  if (width != m_width || height != m_height)
+  {
+    m_width = width;
+    m_height = height;
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, m_width, m_height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+  }
+  glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_viewport[0], m_viewport[1], m_width, m_height);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  m_key = key;
+  m_valid = true;
+}
+
+void CFrameCache::Draw()
+{
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_texture);
+#ifdef SPECTRUM_INSTANCING
+  GLint previousVAO = 0;
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVAO);
+  glBindVertexArray(m_vao);
+#else
+  glBindBuffer(GL_ARRAY_BUFFER, m_quadVBO);
+  glVertexAttribPointer(m_hPosition, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+  glEnableVertexAttribArray(m_hPosition);
+#endif
+
+  EnableShader();
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  DisableShader();
+
+#ifdef SPECTRUM_INSTANCING
+  glBindVertexArray(previousVAO);
+#else
+  glDisableVertexAttribArray(m_hPosition);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+#endif
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void CFrameCache::OnCompiledAndLinked()
+{
+  m_uFrame = glGetUniformLocation(ProgramHandle(), "u_frame");
+  m_hPosition = glGetAttribLocation(ProgramHandle(), "a_position");
+}
+
+bool CFrameCache::OnEnabled()
+{
+  glUniform1i(m_uFrame, 0);
+  return true;
+}
+
+/**
+ * The history as a flat scrolling spectrogram, the "waterfall" mode.
+ *
+ * Every history row is one row of an 8-bit bands x depth ring texture, the newest one drawn at the
+ * top. Upload() sends the rows pushed since the last frame, nothing else changes: the ring head is
+ * a shift of the texture coordinates, the bar palette is applied in the fragment shader. Draw()
+ * covers the viewport with one quad, no depth test, no rotation.
+ */
+class ATTRIBUTE_HIDDEN CWaterfall : public CGLProgram
+{
+public:
+  ~CWaterfall() override { Destroy(); }
+
+  bool Create(unsigned int bands, unsigned int depth);
+  void Destroy();
+  bool IsCreated() const { return m_texture != 0; }
+
+  /**
+   * Uploads the rows "history" got since the last call, all of them the first time.
+   *
+   * @param[in] gain Scales the heights to the 0 to 1 range of the texture.
+   */
+  void Upload(const CSpectrumHistory& history, float gain);
+
+  /**
+   * Has the next Upload() send all the rows, the history was cleared.
+   */
+  void Reset() { m_uploaded = false; }
+
+  /**
+   * Covers the viewport, blending and depth testing must be off.
+   *
+   * @param[in] grids Grids side by side, see CSpectrumAnalyzer::Grids().
+   * @param[in] palette The bar palette texture.
+   */
+  void Draw(unsigned int grids, GLuint palette);
+
+  void OnCompiledAndLinked() override;
+  bool OnEnabled() override;
+
+private:
+  GLuint m_texture = 0;
+  GLuint m_quadVBO = 0;
+#ifdef SPECTRUM_INSTANCING
+  GLuint m_vao = 0;
+#endif
+  std::vector<uint8_t> m_row; // One row, converted to bytes
+  unsigned int m_bands = 0;
+  unsigned int m_depth = 0;
+  unsigned int m_head = 0;
+  unsigned int m_uploadedPushes = 0; // History Pushes() at the last Upload()
+  bool m_uploaded = false;           // Upload() was called since Create()
+  unsigned int m_grids = 1;
+
+  GLint m_uHistory = -1;
+  GLint m_uHistoryHead = -1;
+  GLint m_uHistoryDepth = -1;
+  GLint m_uGrids = -1;
+  GLint m_uPalette = -1;
+  GLint m_hPosition = -1;
+};
+
+/**
+ * Loads the waterfall shaders, creates the quad and the ring texture, cleared to silence.
+ *
+ * Called from Render() the first time the waterfall is drawn, and again after the grid size
+ * changed.
+ */
+bool CWaterfall::Create(unsigned int bands, unsigned int depth)
+{
+  Destroy();
+
+  if (!Load(SPECTRUM_SHADER_DIR "waterfall_vert.glsl", SPECTRUM_SHADER_DIR "waterfall_frag.glsl"))
+  {
+    kodi::Log(ADDON_LOG_ERROR, "Failed to create or compile the waterfall shader");
+    return false;
+  }
+
+  static const GLfloat quad[4][2] = { { -1.0f, -1.0f }, { 1.0f, -1.0f }, { -1.0f, 1.0f }, { 1.0f, 1.0f } };
+  glGenBuffers(1, &m_quadVBO);
+  glBindBuffer(GL_ARRAY_BUFFER, m_quadVBO);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+#ifdef SPECTRUM_INSTANCING
+  GLint previousVAO = 0;
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVAO);
+  glGenVertexArrays(1, &m_vao);
+  glBindVertexArray(m_vao);
+  glVertexAttribPointer(m_hPosition, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+  glEnableVertexAttribArray(m_hPosition);
+  glBindVertexArray(previousVAO);
+#endif
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  // GLES 2.0 has no single channel color format, luminance is the same in the red channel
+#ifdef SPECTRUM_INSTANCING
+  const GLint internalFormat = GL_R8;
+  const GLenum format = GL_RED;
+#else
+  const GLint internalFormat = GL_LUMINANCE;
+  const GLenum format = GL_LUMINANCE;
+#endif
+  // The ring wraps around along T: repeated, the filter blends its last and its first row like any
+  // other two, where clamped it would leave a seam. GLES 2.0 repeats textures of power of two sizes
+  // only, unless GL_OES_texture_npot; the rows are then not filtered at all rather than seamed.
+  GLint filter = GL_LINEAR;
+  GLint wrap = GL_REPEAT;
+#ifndef SPECTRUM_INSTANCING
+  const char* extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+  if (((bands & (bands - 1)) != 0 || (depth & (depth - 1)) != 0) &&
+      (extensions == nullptr || strstr(extensions, "GL_OES_texture_npot") == nullptr))
+  {
+    kodi::Log(ADDON_LOG_DEBUG, "GL_OES_texture_npot is missing, the %u x %u waterfall is not filtered", bands, depth);
+    filter = GL_NEAREST;
+    wrap = GL_CLAMP_TO_EDGE;
+  }
+#endif
+  const std::vector<uint8_t> zeros(bands * depth, 0);
+  GLint alignment = 4;
+  glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glGenTextures(1, &m_texture);
+  glBindTexture(GL_TEXTURE_2D, m_texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+  glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, bands, depth, 0, format, GL_UNSIGNED_BYTE, zeros.data());
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+
+  m_row.resize(bands);
+  m_bands = bands;
+  m_depth = depth;
+  m_head = 0;
+  m_uploaded = false;
+  return true;
+}
+
+void CWaterfall::Destroy()
+{
+  if (!IsCreated())
+    return;
+
+#ifdef SPECTRUM_INSTANCING
+  glDeleteVertexArrays(1, &m_vao);
+  m_vao = 0;
+#endif
+  glDeleteBuffers(1, &m_quadVBO);
+  glDeleteTextures(1, &m_texture);
+  m_quadVBO = 0;
+  m_texture = 0;
+}
+
+void CWaterfall::Upload(const CSpectrumHistory& history, float gain)
+{
+  unsigned int rows = m_uploaded ? history.Pushes() - m_uploadedPushes : m_depth;
+  m_uploaded = true;
+  m_uploadedPushes = history.Pushes();
+  m_head = history.Head();
+  if (rows > m_depth)
+    rows = m_depth;
+  if (rows == 0)
+    return;
+
+#ifdef SPECTRUM_INSTANCING
+  const GLenum format = GL_RED;
+#else
+  const GLenum format = GL_LUMINANCE;
+#endif
+  GLint alignment = 4;
+  glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_texture);
+  while (rows > 0)
+  {
+    rows--;
+    const unsigned int row = history.PhysicalRow(rows);
+    const float* heights = history.RowAt(row);
+    for (unsigned int band = 0; band < m_bands; band++)
+      m_row[band] = static_cast<uint8_t>(std::min(std::max(heights[band] * gain, 0.0f), 1.0f) * 255.0f + 0.5f);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row, m_bands, 1, format, GL_UNSIGNED_BYTE, m_row.data());
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+}
+
+void CWaterfall::Draw(unsigned int grids, GLuint palette)
+{
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, palette);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_texture);
+#ifdef SPECTRUM_INSTANCING
+  GLint previousVAO = 0;
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVAO);
+  glBindVertexArray(m_vao);
+#else
+  glBindBuffer(GL_ARRAY_BUFFER, m_quadVBO);
+  glVertexAttribPointer(m_hPosition, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+  glEnableVertexAttribArray(m_hPosition);
+#endif
+
+  m_grids = grids;
+  EnableShader();
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  DisableShader();
+
+#ifdef SPECTRUM_INSTANCING
+  glBindVertexArray(previousVAO);
+#else
+  glDisableVertexAttribArray(m_hPosition);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+#endif
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void CWaterfall::OnCompiledAndLinked()
+{
+  m_uHistory = glGetUniformLocation(ProgramHandle(), "u_history");
+  m_uHistoryHead = glGetUniformLocation(ProgramHandle(), "u_historyHead");
+  m_uHistoryDepth = glGetUniformLocation(ProgramHandle(), "u_historyDepth");
+  m_uGrids = glGetUniformLocation(ProgramHandle(), "u_grids");
+  m_uPalette = glGetUniformLocation(ProgramHandle(), "u_palette");
+  m_hPosition = glGetAttribLocation(ProgramHandle(), "a_position");
+}
+
+bool CWaterfall::OnEnabled()
+{
+  glUniform1i(m_uHistory, 0);
+  glUniform1f(m_uHistoryHead, static_cast<GLfloat>(m_head));
+  glUniform1f(m_uHistoryDepth, static_cast<GLfloat>(m_depth));
+  glUniform1f(m_uGrids, static_cast<GLfloat>(m_grids));
+  glUniform1i(m_uPalette, 1);
+  return true;
+}
+
+/**
+ * GPU time of the profiled render stages, from GL_TIME_ELAPSED queries.
+ *
+ * Reading a query result right after the stage would wait for the GPU to get there. Every stage
+ * has one query per frame in flight instead: the results of a frame are collected GPU_FRAMES
+ * frames later, and dropped if the GPU is still not done with them by then.
+ *
+ * Timer queries are core in desktop GL 3.3 only, elsewhere this does nothing.
+ */
+class ATTRIBUTE_HIDDEN CGpuStageTimer
+{
+public:
+  /**
+   * Times the scope it lives in as one sample of a GPU stage.
+   */
+  class CScope
+  {
+  public:
+    CScope(CGpuStageTimer& timer, bool enabled, ProfileStage stage)
+      : m_timer(enabled && timer.IsCreated() ? &timer : nullptr)
+    {
+      if (m_timer)
+        m_timer->Begin(stage);
+    }
+    ~CScope()
+    {
+      if (m_timer)
+        m_timer->End();
+    }
+    CScope(const CScope&) = delete;
+    CScope& operator=(const CScope&) = delete;
+
+  private:
+    CGpuStageTimer* m_timer;
+  };
+
+  void Create();
+  void Destroy();
+  bool IsCreated() const { return m_queries[0][0] != 0; }
+
+  /**
+   * Records the results of the oldest frame in flight, then reuses its queries for a new frame.
+   */
+  void NextFrame(CFrameProfiler& profiler);
+
+private:
+  static const unsigned int GPU_FRAMES = 4;
+  static const unsigned int GPU_STAGES = 2; // From ProfileStage::GpuHeights on
+
+  void Begin(ProfileStage stage);
+  void End();
+
+  GLuint m_queries[GPU_FRAMES][GPU_STAGES] = {};
+  bool m_pending[GPU_FRAMES][GPU_STAGES] = {};
+  unsigned int m_frame = 0;
+};
+
+void CGpuStageTimer::Create()
+{
+#ifdef HAS_GL
+  if (IsCreated())
+    return;
+
+  glGenQueries(GPU_FRAMES * GPU_STAGES, &m_queries[0][0]);
+  for (unsigned int frame = 0; frame < GPU_FRAMES; frame++)
+  {
+    for (unsigned int stage = 0; stage < GPU_STAGES; stage++)
+      m_pending[frame][stage] = false;
+  }
+#endif
+}
+
+void CGpuStageTimer::Destroy()
+{
+#ifdef HAS_GL
+  if (!IsCreated())
+    return;
+
+  glDeleteQueries(GPU_FRAMES * GPU_STAGES, &m_queries[0][0]);
+  m_queries[0][0] = 0;
+#endif
+}
+
+void CGpuStageTimer::NextFrame(CFrameProfiler& profiler)
+{
+#ifdef HAS_GL
+  if (!IsCreated())
+    return;
+
+  m_frame = (m_frame + 1) % GPU_FRAMES;
+  for (unsigned int stage = 0; stage < GPU_STAGES; stage++)
+  {
+    if (!m_pending[m_frame][stage])
+      continue;
+
+    GLint available = 0;
+    glGetQueryObjectiv(m_queries[m_frame][stage], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available)
+    {
+      GLuint64 nanoseconds = 0;
+      glGetQueryObjectui64v(m_queries[m_frame][stage], GL_QUERY_RESULT, &nanoseconds);
+      profiler.Record(static_cast<ProfileStage>(static_cast<unsigned int>(ProfileStage::GpuHeights) + stage), nanoseconds * 1e-6f);
+    }
+    m_pending[m_frame][stage] = false;
+  }
+#endif
+}
+
+void CGpuStageTimer::Begin(ProfileStage stage)
+{
+#ifdef HAS_GL
+  const unsigned int index = static_cast<unsigned int>(stage) - static_cast<unsigned int>(ProfileStage::GpuHeights);
+  glBeginQuery(GL_TIME_ELAPSED, m_queries[m_frame][index]);
+  m_pending[m_frame][index] = true;
+#endif
+}
+
+void CGpuStageTimer::End()
+{
+#ifdef HAS_GL
+  glEndQuery(GL_TIME_ELAPSED);
+#endif
+}
+
 /* CLASS DEFINITION */
 class ATTRIBUTE_HIDDEN CVisualizationSpectrum
   : public kodi::addon::CAddonBase,
     public kodi::addon::CInstanceVisualization,
-    public kodi::gui::gl::CShaderProgram
+    public CGLProgram
 {
 public:
   CVisualizationSpectrum();
-  ~CVisualizationSpectrum() override = default;
+  ~CVisualizationSpectrum() override;
 
   bool Start(int channels, int samplesPerSec, int bitsPerSample, std::string songName) override;
   void Stop() override;
@@ -106,41 +1201,146 @@ private:
   void SetModeSetting(int settingValue);
   void SetBarColorSetting(int settingValue);
   void SetRotationSpeedSetting(int settingValue);
-
-  GLfloat   m_heights [NUM_BARS][NUM_BARS];
+  void SetBandsSetting(int settingValue);
+  void SetHistoryDepthSetting(int settingValue);
+  void SetBandReductionSetting(int settingValue);
+  void SetHeightScaleSetting(int settingValue);
+  void SetFFTSizeSetting(int settingValue);
+  void SetChannelLayoutSetting(int settingValue);
+  void SetAttackSetting(int settingValue);
+  void SetReleaseSetting(int settingValue);
+  void SetAdaptiveQualitySetting(int settingValue);
+  void update_kernel_params(void);
+  void log_profile(void);
+  void log_first_frame(void);
+  void apply_quality_level(void);
+  void adapt_quality(const std::chrono::steady_clock::time_point& start, float frameTime);
+  bool scene_is_still(const std::chrono::steady_clock::time_point& now);
+
+  unsigned int m_bandsSetting = NUM_BARS;        // Grid size requested by the settings,
+  unsigned int m_historyDepthSetting = NUM_BARS; // applied to m_analyzer on Start()
+  bool m_builtinFFTSetting = false;              // FFT source and parameters requested by the
+  unsigned int m_fftSizeSetting = 4096;          // settings, applied on Start() too
+  SpectrumWindow m_fftWindowSetting = SpectrumWindow::Hann;
+  float m_fftOverlapSetting = 0.5f;
+  SpectrumChannels m_channelLayoutSetting = SpectrumChannels::Mono;
+  bool m_builtinFFT = false;      // AudioData() runs our own FFT on the samples, not Kodi's data
+  CSpectrumAnalyzer m_analyzer;   // FFT bins to the history of band heights, published to Render()
+  unsigned int m_pendingRows = 0; // Rows to upload on the next frame, on top of the new snapshot rows
+  unsigned int m_uploadedPushes = 0; // Snapshot Pushes() count when it was last uploaded
+  BandKernelParams m_kernelParams;
+  int       m_heightScale = 0;    // 0: linear, 1: logarithmic, 2: decibel
   GLfloat   m_scale;
   GLenum    m_mode;
+  bool      m_surfaceMode = false; // The "surface" mode, m_mode is GL_TRIANGLES then
+  bool      m_waterfallMode = false; // The "waterfall" mode, none of the above applies then
+  float m_attackTime = 0.0f;      // Smoothing time constants of the bar heights, in seconds,
+  float m_releaseTime = 0.0f;     // 0 to follow the spectrum as is
+  float m_attackMix = 1.0f;       // Part of the way to the new heights covered by this frame
+  float m_releaseMix = 1.0f;
+  float m_rowBlend = 1.0f;        // Weight of the newest history row against the one before
+  unsigned int m_blendPushes = 0; // History Pushes() when the current glide started,
+  float m_blendInterval = 0.0f;   // how long it lasts (the stream time between the two rows)
+  std::chrono::steady_clock::time_point m_blendStart; // and when it started
+  std::chrono::steady_clock::time_point m_lastFrameTime;
+  double m_audioTime = 0.0;       // Stream time at the end of the last AudioData() samples, in seconds
+  unsigned int m_channels = 2;
+  unsigned int m_samplesPerSec = CBandMapper::DEFAULT_SAMPLE_RATE;
+  CFrameProfiler m_profiler;      // Stage timings of the "profiling" setting
+  CGpuStageTimer m_gpuTimer;
+  std::chrono::steady_clock::time_point m_profileLogTime; // Last summary in the debug log
+  CFrameCache m_frameCache;       // Last frame, drawn again while the scene is still, or stretched
+  CQualityGovernor m_governor;    // Quality level holding the frame time of the "adaptive_quality" setting
+  float m_qualityTargetSetting = 0.0f; // Frame time to hold in milliseconds, 0 for the full quality
+  std::chrono::steady_clock::time_point m_qualityLogTime; // Last governor state in the debug log
+  unsigned int m_qualityLevel = 0; // Governor level the bars are drawn at,
+  unsigned int m_bandStep = 1;    // which draws every m_bandStep-th band
+  unsigned int m_drawnRows = 1;   // of the newest m_drawnRows rows
+  unsigned int m_drawnBars = 1;   // which makes that many bars,
+  bool m_allFaces = true;         // all their faces or not the sides between bands,
+  float m_renderScale = 1.0f;     // in that part of the viewport
+  std::atomic<unsigned int> m_settingChanges{0}; // Bumped by every SetSetting(), invalidates m_frameCache
+  unsigned int m_stillPushes = 0; // History Pushes() when scene_is_still() last looked,
+  std::chrono::steady_clock::time_point m_lastChange; // and when a row last changed the history
   float m_y_angle, m_y_speed, m_y_fixedAngle;
   float m_x_angle, m_x_speed;
   float m_z_angle, m_z_speed;
   int   m_updateLag;
 
   // Helper functions
-  void draw_bar(GLfloat x_offset, GLfloat z_offset, GLfloat height, GLfloat red, GLfloat green, GLfloat blue);
+  bool create_gl_resources(void);
+#ifdef SPECTRUM_INSTANCING
+  void create_bar_buffers(void);
+  void allocate_grid_buffers(void);
+  void upload_history(void);
+  void update_heights(void);
+  bool draw_surface(void);
+#else
+  void create_bar_buffers(void);
+#endif
+  void update_palette(void);
+  void draw_frame(void);
   void draw_all_bars(void);
+  bool draw_waterfall(bool profiling);
 
   // Private data
   int   m_bar_color_type;
-  bool  m_debugInfoAlreadyDisplayed = false;
 
   glm::mat4 m_projMat;
   glm::mat4 m_modelMat;
   GLfloat   m_pointSize = 0.0f;
-
-  std::vector<glm::vec3> m_vertex_buffer_data;
-  std::vector<glm::vec3> m_color_buffer_data;
-  #ifdef HAS_GL
-    GLuint  m_vertexVBO[2] = {0};
-  #endif
+  GLfloat   m_barWidth = 0.1f;  // Bar size in the X plane
+  GLfloat   m_barDepth = 0.1f;  // Bar size in the Y plane
+
+#ifdef SPECTRUM_INSTANCING
+  GLuint  m_vao = 0;
+  GLuint  m_meshVBO = 0;      // Static unit bar mesh
+  GLuint  m_meshIBO = 0;      // and its triangles, followed by its edges
+  GLuint  m_historyTexture = 0; // GPU copy of the history, one texel per bar
+  CHeightSmoother m_smoother; // Smoothed heights, drawn instead of the history when it runs
+  GLuint  m_heightsTexture = 0; // Texture the bars read their heights from, this frame
+  int     m_heightsHead = 0;    // and the storage row of its newest row
+  float   m_heightsBlend = 1.0f; // and the weight of its newest row against the one before
+  CSurfaceMesh m_surface;     // Heightfield of the surface mode, created by its first frame
+  bool    m_surfaceTried = false; // m_surface.Create() was called for this grid size
+#else
+  GLuint  m_batchVBO = 0;     // Static mesh of GLES2_BATCH_BARS bars, BarVertex
+  GLuint  m_batchIBO = 0;     // and their triangles, edges, points then reduced detail triangles
+  std::vector<GLfloat> m_shownHeights; // Smoothed heights, in grid order, padded to whole vec4s
+#endif
+  GLuint  m_paletteTexture = 0; // Colors of the bars, see BuildBarPalette()
+  CWaterfall m_waterfall;     // Ring of the waterfall mode, created by its first frame
+  bool    m_waterfallTried = false; // m_waterfall.Create() was called for this grid size
+  bool    m_paletteDirty = true;  // The color scheme changed since m_paletteTexture was filled
 
   // Shader related data
   GLint     m_uProjMatrix = -1;
   GLint     m_uModelMatrix = -1;
   GLint     m_uPointSize = -1;
+  GLint     m_uBarSize = -1;
+  GLint     m_uShadeMix = -1;
+  GLint     m_uHistory = -1;
+  GLint     m_uHistoryHead = -1;
+  GLint     m_uHistoryDepth = -1;
+  GLint     m_uBands = -1;
+  GLint     m_uGridBands = -1;
+  GLint     m_uBandStep = -1;
+  GLint     m_uRowBlend = -1;
+  GLint     m_uHeights = -1;
+  GLint     m_uGridSpacing = -1;
+  GLint     m_uBatchFirst = -1;
+  GLint     m_uPalette = -1;
   GLint     m_hPos = -1;
-  GLint     m_hCol = -1;
+  GLint     m_hShade = -1;
+  GLint     m_hBar = -1;
 
   bool  m_startOK = false;
+  bool  m_firstFrameDrawn = false;
+  std::chrono::steady_clock::time_point m_constructionTime; // For the first frame log
+  bool  m_glCreated = false;      // The GL resources, kept from the first Start() to the destructor
+  unsigned int m_allocatedBands = 0; // Grid the buffers sized by it were allocated for
+  unsigned int m_allocatedDepth = 0;
+  unsigned int m_allocatedGrids = 0;
 };
 
 
@@ -154,7 +1354,7 @@ private:
 CVisualizationSpectrum::CVisualizationSpectrum()
   : m_mode(GL_TRIANGLES),
     m_y_angle(45.0f),
-    m_y_speed(1.5f),
+    m_y_speed(90.0f),
     m_x_angle(20.0f),
     m_x_speed(0.0f),
     m_z_angle(0.0f),
@@ -162,8 +1362,13 @@ CVisualizationSpectrum::CVisualizationSpectrum()
     m_updateLag(0),  // Previously this was named m_hSpeed, which is not pertinent anymmore.
     m_bar_color_type(0)
 {
+  m_constructionTime = std::chrono::steady_clock::now();
   m_scale = 1.0 / log(256.0);
 
+  SetBandReductionSetting(kodi::GetSettingInt("band_reduction"));
+  SetHeightScaleSetting(kodi::GetSettingInt("height_scale"));
+  SetAttackSetting(kodi::GetSettingInt("bar_attack"));
+  SetReleaseSetting(kodi::GetSettingInt("bar_release"));
   SetBarHeightSetting(kodi::GetSettingInt("bar_height"));
   SetSpeedSetting(kodi::GetSettingInt("speed"));
   SetModeSetting(kodi::GetSettingInt("mode"));
@@ -172,9 +1377,18 @@ CVisualizationSpectrum::CVisualizationSpectrum()
   SetBarColorSetting (kodi::GetSettingInt("bar_color_type"));
   SetRotationSpeedSetting(kodi::GetSettingInt("rotation_speed"));
 
-  m_vertex_buffer_data.resize(48);
-  m_color_buffer_data.resize(48);
-
+  SetBandsSetting(kodi::GetSettingInt("bands"));
+  SetHistoryDepthSetting(kodi::GetSettingInt("history_depth"));
+  m_builtinFFTSetting = kodi::GetSettingInt("fft_source") == 1;
+  SetFFTSizeSetting(kodi::GetSettingInt("fft_size"));
+  m_fftWindowSetting = kodi::GetSettingInt("fft_window") == 1 ? SpectrumWindow::Blackman : SpectrumWindow::Hann;
+  m_fftOverlapSetting = kodi::GetSettingInt("fft_overlap") == 1 ? 0.75f : 0.5f;
+  SetChannelLayoutSetting(kodi::GetSettingInt("channel_layout"));
+  SetAdaptiveQualitySetting(kodi::GetSettingInt("adaptive_quality"));
+  m_profiler.SetEnabled(kodi::GetSettingInt("profiling") == 1);
+  m_analyzer.Configure(m_bandsSetting, m_historyDepthSetting, 0);
+
+  kodi::Log(ADDON_LOG_DEBUG, "Band kernel: %s", CBandKernel::IsaName(m_analyzer.Kernel().GetIsa()));
   kodi::Log(ADDON_LOG_INFO, "Spectrumolator construction completed...");
 }
 
@@ -192,33 +1406,43 @@ CVisualizationSpectrum::CVisualizationSpectrum()
  */
 bool CVisualizationSpectrum::Start(int channels, int samplesPerSec, int bitsPerSample, std::string songName)
 {
-  (void)channels;
-  (void)samplesPerSec;
   (void)bitsPerSample;
   (void)songName;
 
-  std::string fraqShader = kodi::GetAddonPath("resources/shaders/" GL_TYPE_STRING "/frag.glsl");
-  std::string vertShader = kodi::GetAddonPath("resources/shaders/" GL_TYPE_STRING "/vert.glsl");
-  if (!LoadShaderFiles(vertShader, fraqShader) || !CompileAndLink())
-  {
-    kodi::Log(ADDON_LOG_ERROR, "Failed to create or compile shader");
+  /* Kodi starts and stops the visualization on every song, the GL resources are only created */
+  /* by the first Start(). The following ones reset the history. */
+  if (!m_glCreated && !create_gl_resources())
     return false;
-  }
-
-  int x, y;
 
-  for(x = 0; x < NUM_BARS; x++)
-  {
-    for(y = 0; y < NUM_BARS; y++)
-    {
-      m_heights[y][x] = 0.0f;
-    }
-  }
+  /* AudioData() is not running yet, the stream time can be reset here. */
+  m_channels = channels > 0 ? channels : 1;
+  m_samplesPerSec = samplesPerSec > 0 ? samplesPerSec : CBandMapper::DEFAULT_SAMPLE_RATE;
+  m_audioTime = 0.0;
+  m_builtinFFT = m_builtinFFTSetting &&
+                 m_analyzer.ConfigureSignal(m_fftSizeSetting, m_fftWindowSetting, m_fftOverlapSetting, channels,
+                                            m_channelLayoutSetting);
+  if (m_builtinFFT)
+    kodi::Log(ADDON_LOG_DEBUG, "Built-in FFT of %u samples, %u samples apart, %u signals",
+              m_analyzer.Signal().Size(), m_analyzer.Signal().Hop(), m_analyzer.Signal().Outputs());
+
+  /* All the storage depending on the grid size is allocated here, never per frame. */
+  /* Start with an empty history, the whole of it is sent to the GPU on the first frame. */
+  /* AudioData() is not running yet, this is the only time both sides touch the snapshots. */
+  /* Kodi's FFT data is mono, only the built-in FFT of a stereo stream gets one grid per signal. */
+  const unsigned int grids = m_builtinFFT && m_analyzer.Signal().Outputs() == 2 ? 2 : 1;
+  m_analyzer.Configure(m_bandsSetting, m_historyDepthSetting, samplesPerSec, grids);
+  const CSpectrumHistory& history = m_analyzer.History();
+  m_pendingRows = history.Depth();
+  m_uploadedPushes = 0;
+
+  /* Keep the grid footprint, the bars get thinner when there are more of them. */
+  m_barWidth = GRID_SIZE / history.Bands() / 2.0f;
+  m_barDepth = GRID_SIZE / history.Depth() / 2.0f;
 
 /*
   //Removed superfluous initialiation of member variables, this is the job of the constructor!
   m_x_speed = 0.0f;
-  m_y_speed = 0.5f;
+  m_y_speed = 30.0f;
   m_z_speed = 0.0f;
   m_x_angle = 20.0f;
   m_y_angle = 45.0f;
@@ -227,9 +1451,42 @@ bool CVisualizationSpectrum::Start(int channels, int samplesPerSec, int bitsPerS
 
   m_projMat = glm::frustum(-1.0f, 1.0f, -1.0f, 1.0f, 1.5f, 10.0f);
 
-#ifdef HAS_GL
-  glGenBuffers(2, m_vertexVBO);
+  /* Only a new grid size reallocates what is sized by it. */
+  if (history.Bands() != m_allocatedBands || history.Depth() != m_allocatedDepth ||
+      m_analyzer.Grids() != m_allocatedGrids)
+  {
+#ifdef SPECTRUM_INSTANCING
+    allocate_grid_buffers();
+#endif
+    m_waterfall.Destroy();
+    m_waterfallTried = false;
+    m_allocatedBands = history.Bands();
+    m_allocatedDepth = history.Depth();
+    m_allocatedGrids = m_analyzer.Grids();
+  }
+#ifdef SPECTRUM_INSTANCING
+  m_smoother.Clear();
+#else
+  m_shownHeights.assign((history.Bands() * history.Depth() + 3) / 4 * 4, 0.0f);
 #endif
+  m_waterfall.Reset();
+  m_frameCache.Invalidate();
+
+  /* The governor keeps its level from the previous song, the reduced render scales need to copy */
+  /* the framebuffer. */
+  unsigned int levels = CQualityGovernor::LevelCount();
+  while (levels > 1 && CQualityGovernor::LevelAt(levels - 1).renderScale < 1.0f && !m_frameCache.CanCapture())
+    levels--;
+  m_governor.SetLevelCount(levels);
+  m_governor.SetTarget(m_qualityTargetSetting);
+  apply_quality_level();
+
+  m_lastFrameTime = std::chrono::steady_clock::now();
+  m_profileLogTime = m_lastFrameTime;
+  m_qualityLogTime = m_lastFrameTime;
+  m_lastChange = m_lastFrameTime;
+  m_blendPushes = 0;
+  m_rowBlend = 1.0f;
 
   m_startOK = true;
   return true;
@@ -239,9 +1496,7 @@ bool CVisualizationSpectrum::Start(int channels, int samplesPerSec, int bitsPerS
 /**
  * Stop function of CVisualizationSpectrum class.
  *
- * TBI (add description)
- * This description is not based on the documentation.
- *
+ * The GL resources are kept for the next song, the destructor frees them.
  */
 void CVisualizationSpectrum::Stop()
 {
@@ -249,13 +1504,75 @@ void CVisualizationSpectrum::Stop()
     return;
 
   m_startOK = false;
+}
 
-#ifdef HAS_GL
+
+/**
+ * Class destructor.
+ *
+ * Frees the GL resources created by the first Start(). Kodi destroys the visualization with its
+ * GL context current, like it calls Stop().
+ */
+CVisualizationSpectrum::~CVisualizationSpectrum()
+{
+  if (!m_glCreated)
+    return;
+
+  m_glCreated = false;
+
+#ifdef SPECTRUM_INSTANCING
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glDeleteVertexArrays(1, &m_vao);
+  glDeleteBuffers(1, &m_meshVBO);
+  glDeleteBuffers(1, &m_meshIBO);
+  glDeleteTextures(1, &m_historyTexture);
+  m_smoother.Destroy();
+  m_surface.Destroy();
+  m_vao = 0;
+  m_meshVBO = 0;
+  m_meshIBO = 0;
+  m_historyTexture = 0;
+#else
   glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glDeleteBuffers(2, m_vertexVBO);
-  m_vertexVBO[0] = 0;
-  m_vertexVBO[1] = 0;
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  glDeleteBuffers(1, &m_batchVBO);
+  glDeleteBuffers(1, &m_batchIBO);
+  m_batchVBO = 0;
+  m_batchIBO = 0;
 #endif
+  glDeleteTextures(1, &m_paletteTexture);
+  m_paletteTexture = 0;
+  m_gpuTimer.Destroy();
+  m_frameCache.Destroy();
+  m_waterfall.Destroy();
+}
+
+
+/**
+ * Loads the bar shaders and creates the GL resources which do not depend on the grid size.
+ *
+ * Called only from the first Start(), or from the next ones as long as it fails.
+ */
+bool CVisualizationSpectrum::create_gl_resources(void)
+{
+  if (!Load(SPECTRUM_SHADER_DIR "vert.glsl", SPECTRUM_SHADER_DIR "frag.glsl"))
+  {
+    kodi::Log(ADDON_LOG_ERROR, "Failed to create or compile shader");
+    return false;
+  }
+
+  create_bar_buffers();
+  glGenTextures(1, &m_paletteTexture);
+  m_paletteDirty = true;
+  m_gpuTimer.Create();
+  m_frameCache.Create();
+
+  /* Nothing is sized for a grid yet */
+  m_allocatedBands = 0;
+  m_allocatedDepth = 0;
+  m_allocatedGrids = 0;
+  m_glCreated = true;
+  return true;
 }
 
 /**
@@ -268,41 +1585,130 @@ void CVisualizationSpectrum::Render()
   if (!m_startOK)
     return;
 
-#ifdef HAS_GL
-  glBindBuffer(GL_ARRAY_BUFFER, m_vertexVBO[0]);
-  glVertexAttribPointer(m_hPos, 3, GL_FLOAT, GL_FALSE, sizeof(GLfloat)*3, nullptr);
-  glEnableVertexAttribArray(m_hPos);
+  draw_frame();
+  if (!m_firstFrameDrawn)
+    log_first_frame();
+}
+
+/**
+ * Draws one frame, the whole of Render() once started.
+ */
+void CVisualizationSpectrum::draw_frame(void)
+{
 
-  glBindBuffer(GL_ARRAY_BUFFER, m_vertexVBO[1]);
-  glVertexAttribPointer(m_hCol, 3, GL_FLOAT, GL_FALSE, sizeof(GLfloat)*3, nullptr);
-  glEnableVertexAttribArray(m_hCol);
+  // The statistics of the previous frames are logged before this one is timed.
+  const bool profiling = m_profiler.IsEnabled();
+  if (profiling)
+  {
+    log_profile();
+    m_gpuTimer.NextFrame(m_profiler);
+  }
+  CFrameProfiler::CTimer renderTimer(m_profiler, ProfileStage::Render);
+
+  // Take the latest complete history published by AudioData(), if there is a new one.
+  m_analyzer.Snapshots().Update();
+
+  // Everything that moves (rotation, smoothing) depends on the time since the last frame, not on
+  // the frame rate.
+  const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  const float frameTime = std::chrono::duration<float>(now - m_lastFrameTime).count();
+  const float elapsed = std::min(frameTime, 0.25f);
+  m_lastFrameTime = now;
+  m_attackMix = m_attackTime > 0.0f ? 1.0f - expf(-elapsed / m_attackTime) : 1.0f;
+  m_releaseMix = m_releaseTime > 0.0f ? 1.0f - expf(-elapsed / m_releaseTime) : 1.0f;
+
+  // The waterfall is one quad whatever the grid size, none of the 3D scene below applies to it.
+  if (m_waterfallMode && draw_waterfall(profiling))
+    return;
+
+  // Spectra arrive in steps, at the audio rate. When a new one shows up, the bars glide from the
+  // row before it to it over the stream time between the two, so the motion is smooth at any
+  // refresh rate. This shows the spectrum one row late.
+  const CSpectrumHistory& history = m_analyzer.Snapshots().Front();
+  if (history.Pushes() != m_blendPushes)
+  {
+    m_blendPushes = history.Pushes();
+    m_blendStart = now;
+    m_blendInterval = static_cast<float>(history.Time(0) - history.Time(1));
+  }
+  if (m_blendInterval > 0.0f && m_blendInterval < MAX_ROW_INTERVAL)
+    m_rowBlend = std::min(std::chrono::duration<float>(now - m_blendStart).count() / m_blendInterval, 1.0f);
+  else
+    m_rowBlend = 1.0f;
+
+  // Draw at the level the governor picked over the last frames, see adapt_quality().
+  m_governor.SetTarget(m_qualityTargetSetting);
+  if (m_governor.Level() != m_qualityLevel)
+    apply_quality_level();
+
+  // While nothing moves, the last frame is drawn again instead of the whole grid.
+  const bool still = scene_is_still(now);
+  const unsigned int sceneKey = m_settingChanges.load(std::memory_order_relaxed);
+  if (still && m_frameCache.IsValidFor(sceneKey))
+  {
+    glDisable(GL_BLEND);
+    m_frameCache.Draw();
+    glEnable(GL_BLEND);
+    return;
+  }
+
+#ifdef SPECTRUM_INSTANCING
+  // All attribute state lives in our own VAO, so Kodi's bindings are left untouched.
+  GLint previousVAO = 0;
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVAO);
+  glBindVertexArray(m_vao);
 #else
-  // 1st attribute buffer : vertices
+  // Without VAOs, the grid mesh attributes are enabled on every frame and disabled afterwards,
+  // draw_all_bars() points them at each batch.
+  glBindBuffer(GL_ARRAY_BUFFER, m_batchVBO);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_batchIBO);
   glEnableVertexAttribArray(m_hPos);
-  glVertexAttribPointer(m_hPos, 3, GL_FLOAT, GL_FALSE, 0, &m_vertex_buffer_data[0]);
-
-  // 2nd attribute buffer : colors
-  glEnableVertexAttribArray(m_hCol);
-  glVertexAttribPointer(m_hCol, 3, GL_FLOAT, GL_FALSE, 0, &m_color_buffer_data[0]);
+  glEnableVertexAttribArray(m_hShade);
+  glEnableVertexAttribArray(m_hBar);
 #endif
 
   glDisable(GL_BLEND);
+#ifdef SPECTRUM_INSTANCING
+  {
+    CFrameProfiler::CTimer timer(m_profiler, ProfileStage::Heights);
+    CGpuStageTimer::CScope gpuTimer(m_gpuTimer, profiling, ProfileStage::GpuHeights);
+    update_heights();
+  }
+#endif
 #ifdef HAS_GL
   glEnable(GL_PROGRAM_POINT_SIZE);
 #endif
   glEnable(GL_DEPTH_TEST);
   glDepthFunc(GL_LESS);
+  if (m_mode == GL_TRIANGLES && !m_surfaceMode)
+  {
+    // Faces turned away from the camera are hidden behind the ones facing it anyway
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+    glFrontFace(GL_CCW);
+  }
+
+  // At a reduced render scale, the scene is drawn in the bottom left part of the viewport, which
+  // is stretched over the whole of it afterwards.
+  GLint viewport[4] = {0, 0, 0, 0};
+  const bool scaled = m_renderScale < 1.0f;
+  if (scaled)
+  {
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glViewport(viewport[0], viewport[1], CFrameCache::Scaled(viewport[2], m_renderScale),
+               CFrameCache::Scaled(viewport[3], m_renderScale));
+  }
 
   // Clear the screen
   glClear(GL_DEPTH_BUFFER_BIT);
 
-  m_x_angle += m_x_speed;
+  m_x_angle += m_x_speed * elapsed;
   if(m_x_angle >= 360.0f)
     m_x_angle -= 360.0f;
 
   if (m_y_fixedAngle < 0.0f)
   {
-    m_y_angle += m_y_speed;
+    m_y_angle += m_y_speed * elapsed;
     if(m_y_angle >= 360.0f)
       m_y_angle -= 360.0f;
   }
@@ -311,7 +1717,7 @@ void CVisualizationSpectrum::Render()
     m_y_angle = m_y_fixedAngle;
   }
 
-  m_z_angle += m_z_speed;
+  m_z_angle += m_z_speed * elapsed;
   if(m_z_angle >= 360.0f)
     m_z_angle -= 360.0f;
 
@@ -320,210 +1726,361 @@ void CVisualizationSpectrum::Render()
   m_modelMat = glm::rotate(m_modelMat, glm::radians(m_y_angle), glm::vec3(0.0f, 1.0f, 0.0f));
   m_modelMat = glm::rotate(m_modelMat, glm::radians(m_z_angle), glm::vec3(0.0f, 0.0f, 1.0f));
 
-  EnableShader();
+  {
+    CFrameProfiler::CTimer timer(m_profiler, ProfileStage::Draw);
+    CGpuStageTimer::CScope gpuTimer(m_gpuTimer, profiling, ProfileStage::GpuDraw);
 
-  draw_all_bars();
+#ifdef SPECTRUM_INSTANCING
+    if (!draw_surface())
+#endif
+    {
+      EnableShader();
 
-  DisableShader();
+      draw_all_bars();
+
+      DisableShader();
+    }
+  }
 
+#ifdef SPECTRUM_INSTANCING
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindVertexArray(previousVAO);
+#else
   glDisableVertexAttribArray(m_hPos);
-  glDisableVertexAttribArray(m_hCol);
+  glDisableVertexAttribArray(m_hShade);
+  glDisableVertexAttribArray(m_hBar);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+#endif
 
+  glDisable(GL_CULL_FACE);
   glDisable(GL_DEPTH_TEST);
 #ifdef HAS_GL
   glDisable(GL_PROGRAM_POINT_SIZE);
 #endif
+
+  if (scaled)
+  {
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    m_frameCache.Capture(sceneKey, m_renderScale);
+    if (m_frameCache.IsValidFor(sceneKey))
+      m_frameCache.Draw();
+  }
+  else if (still)
+  {
+    m_frameCache.Capture(sceneKey);
+  }
+  else
+  {
+    m_frameCache.Invalidate();
+  }
   glEnable(GL_BLEND);
+
+  adapt_quality(now, frameTime);
 }
 
 void CVisualizationSpectrum::OnCompiledAndLinked()
 {
-  // Variables passed directly to the Vertex shader
-  m_uProjMatrix = glGetUniformLocation(ProgramHandle(), "u_projectionMatrix");
-  m_uModelMatrix = glGetUniformLocation(ProgramHandle(), "u_modelViewMatrix");
-  m_uPointSize = glGetUniformLocation(ProgramHandle(), "u_pointSize");
-  m_hPos = glGetAttribLocation(ProgramHandle(), "a_position");
-  m_hCol = glGetAttribLocation(ProgramHandle(), "a_color");
+  // Variables passed directly to the Vertex shader
+  m_uProjMatrix = glGetUniformLocation(ProgramHandle(), "u_projectionMatrix");
+  m_uModelMatrix = glGetUniformLocation(ProgramHandle(), "u_modelViewMatrix");
+  m_uPointSize = glGetUniformLocation(ProgramHandle(), "u_pointSize");
+  m_uBarSize = glGetUniformLocation(ProgramHandle(), "u_barSize");
+  m_uShadeMix = glGetUniformLocation(ProgramHandle(), "u_shadeMix");
+  m_uHistory = glGetUniformLocation(ProgramHandle(), "u_history");
+  m_uHistoryHead = glGetUniformLocation(ProgramHandle(), "u_historyHead");
+  m_uHistoryDepth = glGetUniformLocation(ProgramHandle(), "u_historyDepth");
+  m_uBands = glGetUniformLocation(ProgramHandle(), "u_bands");
+  m_uGridBands = glGetUniformLocation(ProgramHandle(), "u_gridBands");
+  m_uBandStep = glGetUniformLocation(ProgramHandle(), "u_bandStep");
+  m_uRowBlend = glGetUniformLocation(ProgramHandle(), "u_rowBlend");
+  m_uHeights = glGetUniformLocation(ProgramHandle(), "u_heights");
+  m_uGridSpacing = glGetUniformLocation(ProgramHandle(), "u_gridSpacing");
+  m_uBatchFirst = glGetUniformLocation(ProgramHandle(), "u_batchFirst");
+  m_uPalette = glGetUniformLocation(ProgramHandle(), "u_palette");
+  m_hPos = glGetAttribLocation(ProgramHandle(), "a_position");
+  m_hShade = glGetAttribLocation(ProgramHandle(), "a_shade");
+  m_hBar = glGetAttribLocation(ProgramHandle(), "a_bar");
+}
+
+bool CVisualizationSpectrum::OnEnabled()
+{
+  // This is called after glUseProgram()
+  glUniformMatrix4fv(m_uProjMatrix, 1, GL_FALSE, glm::value_ptr(m_projMat));
+  glUniformMatrix4fv(m_uModelMatrix, 1, GL_FALSE, glm::value_ptr(m_modelMat));
+  glUniform1f(m_uPointSize, m_pointSize);
+  glUniform2f(m_uBarSize, m_barWidth * m_bandStep, m_barDepth);
+  // The face shading only makes sense for filled bars, lines and points use the plain bar color.
+  glUniform1f(m_uShadeMix, m_mode == GL_TRIANGLES ? 1.0f : 0.0f);
+  glUniform1i(m_uHistory, 0);
+  glUniform1i(m_uPalette, 1);
+  const CSpectrumHistory& history = m_analyzer.Snapshots().Front();
+#ifdef SPECTRUM_INSTANCING
+  glUniform1i(m_uHistoryHead, m_heightsHead);
+  glUniform1f(m_uRowBlend, m_heightsBlend);
+#else
+  glUniform1i(m_uHistoryHead, history.Head());
+#endif
+  glUniform1i(m_uHistoryDepth, history.Depth());
+  glUniform1i(m_uBands, history.Bands());
+  glUniform1i(m_uGridBands, history.Bands() / m_analyzer.Grids());
+  glUniform1i(m_uBandStep, m_bandStep);
+  glUniform2f(m_uGridSpacing, GRID_SIZE / history.Bands(), GRID_SIZE / history.Depth());
+
+  return true;
+}
+
+
+
+#ifdef SPECTRUM_INSTANCING
+/**
+ * Creates the vertex array object and the buffers used by the instanced bar grid.
+ *
+ * The unit bar mesh is uploaded once here, the buffers sized by the grid are allocated by
+ * allocate_grid_buffers(). Called only from create_gl_resources(), after the shader program is
+ * linked.
+ */
+void CVisualizationSpectrum::create_bar_buffers(void)
+{
+  glGenVertexArrays(1, &m_vao);
+  glGenBuffers(1, &m_meshVBO);
+  glGenBuffers(1, &m_meshIBO);
+  glGenTextures(1, &m_historyTexture);
+
+  GLint previousVAO = 0;
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVAO);
+  glBindVertexArray(m_vao);
+
+  // Per-vertex data: the unit bar mesh
+  glBindBuffer(GL_ARRAY_BUFFER, m_meshVBO);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(unitBarMesh), unitBarMesh, GL_STATIC_DRAW);
+  glVertexAttribPointer(m_hPos, 3, GL_FLOAT, GL_FALSE, sizeof(unitBarMesh[0]), nullptr);
+  glEnableVertexAttribArray(m_hPos);
+  glVertexAttribPointer(m_hShade, 1, GL_FLOAT, GL_FALSE, sizeof(unitBarMesh[0]), (const GLvoid*)(3 * sizeof(GLfloat)));
+  glEnableVertexAttribArray(m_hShade);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_meshIBO);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unitBarIndices) + sizeof(unitBarEdges), nullptr, GL_STATIC_DRAW);
+  glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, sizeof(unitBarIndices), unitBarIndices);
+  glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unitBarIndices), sizeof(unitBarEdges), unitBarEdges);
+
+  // There is no per-instance data, the vertex shader places each bar from its instance ID and the
+  // colors come from the palette texture
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindVertexArray(previousVAO);
+
+  // Bar heights: one texel per band and per history row, read by the vertex shader
+  glBindTexture(GL_TEXTURE_2D, m_historyTexture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/**
+ * Sizes the history texture and the smoothed heights for the grid of m_analyzer. The surface
+ * mesh is built again by its next frame.
+ *
+ * Called from Start() when the grid size changed.
+ */
+void CVisualizationSpectrum::allocate_grid_buffers(void)
+{
+  const CSpectrumHistory& history = m_analyzer.History();
+
+  glBindTexture(GL_TEXTURE_2D, m_historyTexture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, history.Bands(), history.Depth(), 0, GL_RED, GL_FLOAT, nullptr);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  m_smoother.Create(history.Bands(), history.Depth());
+  m_surface.Destroy();
+  m_surfaceTried = false;
+}
+
+/**
+ * Uploads the history rows written by AudioData() since the last frame.
+ *
+ * AudioData() runs on the audio thread without a GL context, so it only pushes the new row into
+ * the history and publishes a snapshot of it. The rows the latest snapshot got since the last frame
+ * are sent here, one glTexSubImage2D() per row,
+ * which keeps the upload at one row per update whatever the history depth.
+ * Called only from draw_all_bars().
+ */
+void CVisualizationSpectrum::upload_history(void)
+{
+  const CSpectrumHistory& history = m_analyzer.Snapshots().Front();
+  unsigned int rows = m_pendingRows + (history.Pushes() - m_uploadedPushes);
+  unsigned int row;
+
+  m_pendingRows = 0;
+  m_uploadedPushes = history.Pushes();
+  if (rows > history.Depth())
+    rows = history.Depth();
+
+  while (rows > 0)
+  {
+    rows--;
+    row = history.PhysicalRow(rows);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row, history.Bands(), 1, GL_RED, GL_FLOAT, history.RowAt(row));
+  }
+}
+
+
+/**
+ * Brings the history texture up to date, then smoothes it into the heights drawn by this frame.
+ *
+ * Without smoothing (or when the GPU cannot do it), the bars are drawn straight from the history.
+ * Called only from Render(), before the bar program is enabled.
+ */
+void CVisualizationSpectrum::update_heights(void)
+{
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_historyTexture);
+  upload_history();
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  const int head = m_analyzer.Snapshots().Front().Head();
+  if (m_smoother.IsCreated() && (m_attackMix < 1.0f || m_releaseMix < 1.0f))
+  {
+    m_heightsTexture = m_smoother.Update(m_historyTexture, head, m_attackMix, m_releaseMix, m_rowBlend);
+    m_heightsHead = 0;
+    m_heightsBlend = 1.0f;
+  }
+  else
+  {
+    m_heightsTexture = m_historyTexture;
+    m_heightsHead = head;
+    m_heightsBlend = m_rowBlend;
+  }
+}
+
+
+/**
+ * Function to draw all the bars (it's in the name).
+ *
+ * The whole bands x history depth grid is drawn with one instanced draw call, the vertex shader
+ * fetches each bar height from the history texture, or from the smoothed heights. In wireframe
+ * mode, the call draws the edges of the bars instead of their faces, in point mode one sprite on
+ * the top of each bar. Only the bars of the current quality level are drawn: every m_bandStep-th
+ * band of the newest m_drawnRows rows, placed by the vertex shader from their instance ID.
+ * Called only from CVisualizationSpectrum::Render() function.
+ *
+ */
+void CVisualizationSpectrum::draw_all_bars(void)
+{
+  if (m_paletteDirty)
+    update_palette();
+
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, m_paletteTexture);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_heightsTexture);
+
+  const GLsizei faceIndices = m_allFaces ? BAR_MESH_INDICES : BAR_REDUCED_INDICES;
+  if (m_mode == GL_LINES)
+    glDrawElementsInstanced(GL_LINES, BAR_EDGE_INDICES, GL_UNSIGNED_BYTE, (const GLvoid*)sizeof(unitBarIndices), m_drawnBars);
+  else if (m_mode == GL_POINTS)
+    glDrawArraysInstanced(GL_POINTS, BAR_POINT_VERTEX, 1, m_drawnBars);
+  else
+    glDrawElementsInstanced(m_mode, faceIndices, GL_UNSIGNED_BYTE, (const GLvoid*)(BAR_MESH_INDICES - faceIndices), m_drawnBars);
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
 }
 
-bool CVisualizationSpectrum::OnEnabled()
+
+/**
+ * Draws the history as one heightfield in the surface mode, see CSurfaceMesh.
+ *
+ * The mesh is built the first time, if that fails the bars are drawn instead until the grid size
+ * changes. Of the quality levels, only the rows and the render scale apply. Called only from
+ * Render(), after update_heights().
+ *
+ * @return false if the bars are to be drawn instead.
+ */
+bool CVisualizationSpectrum::draw_surface(void)
 {
-  // This is called after glUseProgram()
-  glUniformMatrix4fv(m_uProjMatrix, 1, GL_FALSE, glm::value_ptr(m_projMat));
-  glUniformMatrix4fv(m_uModelMatrix, 1, GL_FALSE, glm::value_ptr(m_modelMat));
-  glUniform1f(m_uPointSize, m_pointSize);
+  if (!m_surfaceMode)
+    return false;
+
+  const CSpectrumHistory& history = m_analyzer.Snapshots().Front();
+  if (!m_surface.IsCreated())
+  {
+    if (m_surfaceTried)
+      return false;
+    m_surfaceTried = true;
+    if (!m_surface.Create(history.Bands(), history.Depth()))
+      return false;
+    m_profiler.CountAllocations(ProfileStage::Render, 4); // The shader sources, the cells and the strip indices
+  }
 
+  if (m_paletteDirty)
+    update_palette();
+  m_surface.Draw(m_projMat, m_modelMat, m_heightsTexture, m_heightsHead, m_heightsBlend,
+                 history.Bands() / m_analyzer.Grids(), m_drawnRows, m_paletteTexture);
   return true;
 }
 
-
-
+#else
 /**
- * Function to draw one bar.
- *
- * Called only from draw_all_bars() function.
- *
- * @param GLfloat x_offset
- * @param GLfloat z_offset
- * @param GLfloat height
- * @param GLfloat red
- * @param GLfloat green
- * @param GLfloat blue
- */
-void CVisualizationSpectrum::draw_bar(GLfloat x_offset, GLfloat z_offset, GLfloat height, GLfloat red, GLfloat green, GLfloat blue )
-{
-  GLfloat width = 0.1f;
-  m_vertex_buffer_data =
-  {
-    // Bottom
-    { x_offset + width, 0.0f,   z_offset + width },
-    { x_offset,         0.0f,   z_offset },
-    { x_offset + width, 0.0f,   z_offset },
-    { x_offset + width, 0.0f,   z_offset + width },
-    { x_offset,         0.0f,   z_offset + width },
-    { x_offset,         0.0f,   z_offset },
-
-    { x_offset,         0.0f,   z_offset + width },
-    { x_offset + width, 0.0f,   z_offset },
-    { x_offset + width, 0.0f,   z_offset + width },
-    { x_offset,         0.0f,   z_offset + width },
-    { x_offset + width, 0.0f,   z_offset },
-    { x_offset,         0.0f,   z_offset },
-
-    // Side
-    { x_offset,         0.0f,   z_offset },
-    { x_offset,         0.0f,   z_offset + width },
-    { x_offset,         height, z_offset + width },
-    { x_offset,         0.0f,   z_offset },
-    { x_offset,         height, z_offset + width },
-    { x_offset,         height, z_offset },
-
-    { x_offset + width, height, z_offset },
-    { x_offset,         0.0f,   z_offset },
-    { x_offset,         height, z_offset },
-    { x_offset + width, height, z_offset },
-    { x_offset + width, 0.0f,   z_offset },
-    { x_offset,         0.0f,   z_offset },
-
-    { x_offset,         height, z_offset + width },
-    { x_offset,         0.0f,   z_offset + width },
-    { x_offset + width, 0.0f,   z_offset + width },
-    { x_offset + width, height, z_offset + width },
-    { x_offset,         height, z_offset + width },
-    { x_offset + width, 0.0f,   z_offset + width },
-
-    { x_offset + width, height, z_offset + width },
-    { x_offset + width, 0.0f,   z_offset },
-    { x_offset + width, height, z_offset },
-    { x_offset + width, 0.0f,   z_offset },
-    { x_offset + width, height, z_offset + width },
-    { x_offset + width, 0.0f,   z_offset + width },
-
-    // Top
-    { x_offset + width, height, z_offset + width },
-    { x_offset + width, height, z_offset },
-    { x_offset,         height, z_offset },
-    { x_offset + width, height, z_offset + width },
-    { x_offset,         height, z_offset },
-    { x_offset,         height, z_offset + width },
-
-    { x_offset,         height, z_offset + width },
-    { x_offset + width, height, z_offset },
-    { x_offset,         height, z_offset },
-    { x_offset + width, height, z_offset },
-    { x_offset + width, height, z_offset + width },
-    { x_offset,         height, z_offset + width }
-  };
-
-  float sideMlpy1, sideMlpy2, sideMlpy3, sideMlpy4;
-  if (m_mode == GL_TRIANGLES)
+ * Creates the static mesh of a batch of GLES2_BATCH_BARS bars: the unit bar mesh once per bar,
+ * with the index of the bar in the batch, and their triangles, edges, points and reduced detail
+ * triangles. Every batch of the grid is drawn with it, the vertex shader places each bar from its
+ * index in the grid, so neither depends on the grid size or on the band step.
+ *
+ * The indices stay within 16 bits, which is all GLES 2.0 guarantees.
+ * Called only from create_gl_resources(), after the shader program is linked.
+ */
+void CVisualizationSpectrum::create_bar_buffers(void)
+{
+  std::vector<BarVertex> vertices(GLES2_BATCH_BARS * BAR_MESH_VERTICES);
+  std::vector<GLushort> indices(GLES2_BATCH_BARS * (BAR_MESH_INDICES + BAR_EDGE_INDICES + 1 + BAR_REDUCED_INDICES));
+  GLushort* edges = &indices[GLES2_BATCH_BARS * BAR_MESH_INDICES];
+  GLushort* points = &edges[GLES2_BATCH_BARS * BAR_EDGE_INDICES];
+  GLushort* reduced = &points[GLES2_BATCH_BARS];
+  BarVertex* vertex = vertices.data();
+  unsigned int bar;
+  unsigned int i;
+
+  for (bar = 0; bar < GLES2_BATCH_BARS; bar++)
   {
-    sideMlpy1 = 0.5f;
-    sideMlpy2 = 0.25f;
-    sideMlpy3 = 0.75f;
-    sideMlpy4 = 0.5f;
+    for (const GLfloat (&corner)[4] : unitBarMesh)
+    {
+      vertex->x = corner[0];
+      vertex->y = corner[1];
+      vertex->z = corner[2];
+      vertex->shade = static_cast<GLubyte>(lroundf(corner[3] * 255.0f));
+      vertex->bar = static_cast<GLubyte>(bar);
+      vertex++;
+    }
+    for (i = 0; i < BAR_MESH_INDICES; i++)
+      indices[bar * BAR_MESH_INDICES + i] = static_cast<GLushort>(bar * BAR_MESH_VERTICES + unitBarIndices[i]);
+    for (i = 0; i < BAR_EDGE_INDICES; i++)
+      edges[bar * BAR_EDGE_INDICES + i] = static_cast<GLushort>(bar * BAR_MESH_VERTICES + unitBarEdges[i]);
+    points[bar] = static_cast<GLushort>(bar * BAR_MESH_VERTICES + BAR_POINT_VERTEX);
+    for (i = 0; i < BAR_REDUCED_INDICES; i++)
+      reduced[bar * BAR_REDUCED_INDICES + i] = indices[bar * BAR_MESH_INDICES + BAR_MESH_INDICES - BAR_REDUCED_INDICES + i];
   }
-  else
-  {
-    sideMlpy1 = sideMlpy2 = sideMlpy3 = sideMlpy4 = 1.0f;
-  }
-
-  // One color for each vertex. They were generated randomly.
-  m_color_buffer_data =
-  {
-    // Bottom
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-
-    // Side
-    { red * sideMlpy1, green * sideMlpy1, blue * sideMlpy1 },
-    { red * sideMlpy1, green * sideMlpy1, blue * sideMlpy1 },
-    { red * sideMlpy1, green * sideMlpy1, blue * sideMlpy1 },
-    { red * sideMlpy1, green * sideMlpy1, blue * sideMlpy1 },
-    { red * sideMlpy1, green * sideMlpy1, blue * sideMlpy1 },
-    { red * sideMlpy1, green * sideMlpy1, blue * sideMlpy1 },
-
-    { red * sideMlpy2, green * sideMlpy2, blue * sideMlpy2 },
-    { red * sideMlpy2, green * sideMlpy2, blue * sideMlpy2 },
-    { red * sideMlpy2, green * sideMlpy2, blue * sideMlpy2 },
-    { red * sideMlpy2, green * sideMlpy2, blue * sideMlpy2 },
-    { red * sideMlpy2, green * sideMlpy2, blue * sideMlpy2 },
-    { red * sideMlpy2, green * sideMlpy2, blue * sideMlpy2 },
-
-    { red * sideMlpy3, green * sideMlpy3, blue * sideMlpy3 },
-    { red * sideMlpy3, green * sideMlpy3, blue * sideMlpy3 },
-    { red * sideMlpy3, green * sideMlpy3, blue * sideMlpy3 },
-    { red * sideMlpy3, green * sideMlpy3, blue * sideMlpy3 },
-    { red * sideMlpy3, green * sideMlpy3, blue * sideMlpy3 },
-    { red * sideMlpy3, green * sideMlpy3, blue * sideMlpy3 },
-
-    { red * sideMlpy4, green * sideMlpy4, blue * sideMlpy4 },
-    { red * sideMlpy4, green * sideMlpy4, blue * sideMlpy4 },
-    { red * sideMlpy4, green * sideMlpy4, blue * sideMlpy4 },
-    { red * sideMlpy4, green * sideMlpy4, blue * sideMlpy4 },
-    { red * sideMlpy4, green * sideMlpy4, blue * sideMlpy4 },
-    { red * sideMlpy4, green * sideMlpy4, blue * sideMlpy4 },
-
-    // Top
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-    { red, green, blue },
-  };
 
-#ifdef HAS_GL
-  glBindBuffer(GL_ARRAY_BUFFER, m_vertexVBO[0]);
-  glBufferData(GL_ARRAY_BUFFER, m_vertex_buffer_data.size()*sizeof(glm::vec3), &m_vertex_buffer_data[0], GL_STATIC_DRAW);
-  glBindBuffer(GL_ARRAY_BUFFER, m_vertexVBO[1]);
-  glBufferData(GL_ARRAY_BUFFER, m_color_buffer_data.size()*sizeof(glm::vec3), &m_color_buffer_data[0], GL_STATIC_DRAW);
-#endif
-  glDrawArrays(m_mode, 0, m_vertex_buffer_data.size()); /* 12*3 indices starting at 0 -> 12 triangles + 4*3 to have on lines show correct */
+  glGenBuffers(1, &m_batchVBO);
+  glBindBuffer(GL_ARRAY_BUFFER, m_batchVBO);
+  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(BarVertex), vertices.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  glGenBuffers(1, &m_batchIBO);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_batchIBO);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
 
 /**
  * Function to draw all the bars (it's in the name).
  *
+ * The batch mesh is static, only the bar heights are sent, through the u_heights uniform array,
+ * with the index of the first bar of the batch in the grid. One draw call per GLES2_BATCH_BARS
+ * bars, a single one for grids up to 16 x 16.
  * Called only from CVisualizationSpectrum::Render() function.
  *
  */
@@ -531,61 +2088,123 @@ void CVisualizationSpectrum::draw_all_bars(void)
 {
   int x;
   int y;
-  GLfloat x_offset;
-  GLfloat y_offset;
-  GLfloat r_base;
-  GLfloat b_base;
-  GLfloat rgb_component_r;
-  GLfloat rgb_component_g;
-  GLfloat rgb_component_b;
+  const CSpectrumHistory& history = m_analyzer.Snapshots().Front();
+  const int depth = history.Depth();
+  const int drawnBands = history.Bands() / m_bandStep;
+  const int drawnRows = m_drawnRows;
+  const unsigned int bars = m_drawnBars;
 
-  for(y = 0; y < NUM_BARS; y++)
-  {
-    y_offset = -1.6 + ((NUM_BARS - y) * 0.2);
+  if (m_paletteDirty)
+    update_palette();
 
-    b_base = y * (1.0 / NUM_BARS);
-    r_base = 1.0 - b_base;
+  /* Without instancing the heights are handled on the CPU, so is their smoothing. */
+  for(y = 0; y < drawnRows; y++)
+  {
+    const float* row = history.Row(y);
+    const float* older = y + 1 < depth ? history.Row(y + 1) : row;
+    GLfloat* shownRow = &m_shownHeights[y * drawnBands];
 
-    for(x = 0; x < NUM_BARS; x++)
+    for(x = 0; x < drawnBands; x++)
     {
-      x_offset = -1.6 + ((float)x * 0.2);
-
-      switch(m_bar_color_type)
-      {
-        case 2:
-          /* Two gradient color */
-          rgb_component_r = 1.0f - (float(x) - float(NUM_BARS))/float(NUM_BARS);
-          rgb_component_g = (float(x) - float(NUM_BARS))/float(NUM_BARS);
-          rgb_component_b = 0.0f;
-          break;
-
-        case 1:
-          /* One solid color */
-          rgb_component_r = 1;
-          rgb_component_g = 0;
-          rgb_component_b = 0;
-          break;
-
-        case 0:
-        default:
-          // Original code... which is a bit arbitrary
-          rgb_component_r = r_base - (float(x) * (r_base / float(NUM_BARS))); /* R component */
-          rgb_component_g = (float)x * (1.0 / float(NUM_BARS));                 /* G component */
-          rgb_component_b = b_base;                                /* B component */
-          break;
-      };
-
-      draw_bar( x_offset,            /* X Offset */
-                y_offset,            /* Y Offset */
-                m_heights[y][x],     /* Height */
-                rgb_component_r,     /* R component */
-                rgb_component_g,     /* G component */
-                rgb_component_b);    /* B component */
+      const int band = x * m_bandStep;
+      const GLfloat target = older[band] + (row[band] - older[band]) * m_rowBlend;
+      GLfloat& shown = shownRow[x];
+      shown += (target - shown) * (target > shown ? m_attackMix : m_releaseMix);
     };
   };
+
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, m_paletteTexture);
+
+  glVertexAttribPointer(m_hPos, 3, GL_FLOAT, GL_FALSE, sizeof(BarVertex), (const GLvoid*)offsetof(BarVertex, x));
+  glVertexAttribPointer(m_hShade, 1, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(BarVertex), (const GLvoid*)offsetof(BarVertex, shade));
+  glVertexAttribPointer(m_hBar, 1, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(BarVertex), (const GLvoid*)offsetof(BarVertex, bar));
+  for (unsigned int first = 0; first < bars; first += GLES2_BATCH_BARS)
+  {
+    const unsigned int count = std::min(bars - first, GLES2_BATCH_BARS);
+    glUniform1f(m_uBatchFirst, static_cast<GLfloat>(first));
+    glUniform4fv(m_uHeights, (count + 3) / 4, &m_shownHeights[first]);
+    if (m_mode == GL_LINES)
+      glDrawElements(GL_LINES, count * BAR_EDGE_INDICES, GL_UNSIGNED_SHORT, (const GLvoid*)(GLES2_BATCH_BARS * BAR_MESH_INDICES * sizeof(GLushort)));
+    else if (m_mode == GL_POINTS)
+      glDrawElements(GL_POINTS, count, GL_UNSIGNED_SHORT, (const GLvoid*)(GLES2_BATCH_BARS * (BAR_MESH_INDICES + BAR_EDGE_INDICES) * sizeof(GLushort)));
+    else if (!m_allFaces)
+      glDrawElements(m_mode, count * BAR_REDUCED_INDICES, GL_UNSIGNED_SHORT, (const GLvoid*)(GLES2_BATCH_BARS * (BAR_MESH_INDICES + BAR_EDGE_INDICES + 1) * sizeof(GLushort)));
+    else
+      glDrawElements(m_mode, count * BAR_MESH_INDICES, GL_UNSIGNED_SHORT, nullptr);
+  }
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+}
+#endif
+
+
+/**
+ * Fills the palette texture with the current color scheme.
+ *
+ * The bar colors are looked up in the fragment shader, so a scheme change costs one small
+ * upload, whatever the grid size. Called from draw_all_bars() when the color scheme was changed.
+ */
+void CVisualizationSpectrum::update_palette(void)
+{
+  uint8_t palette[BAR_PALETTE_SIZE * BAR_PALETTE_SIZE * 4];
+  BuildBarPalette(m_bar_color_type, palette);
+
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, m_paletteTexture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, BAR_PALETTE_SIZE, BAR_PALETTE_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, palette);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+
+  m_paletteDirty = false;
 }
 
 
+/**
+ * Draws the history as a scrolling spectrogram in the waterfall mode, see CWaterfall.
+ *
+ * The waterfall is created the first time, if that fails the bars are drawn instead until the grid
+ * size changes. Its cost does not depend on anything the quality levels change, the governor is left
+ * alone. Called only from Render().
+ *
+ * @param[in] profiling The Render() stages are timed.
+ * @return false if the bars are to be drawn instead.
+ */
+bool CVisualizationSpectrum::draw_waterfall(bool profiling)
+{
+  const CSpectrumHistory& history = m_analyzer.Snapshots().Front();
+  if (!m_waterfall.IsCreated())
+  {
+    if (m_waterfallTried)
+      return false;
+    m_waterfallTried = true;
+    if (!m_waterfall.Create(history.Bands(), history.Depth()))
+      return false;
+    m_profiler.CountAllocations(ProfileStage::Render, 4); // The shader sources, the cleared ring and the row
+  }
+
+  {
+    CFrameProfiler::CTimer timer(m_profiler, ProfileStage::Heights);
+    CGpuStageTimer::CScope gpuTimer(m_gpuTimer, profiling, ProfileStage::GpuHeights);
+    // A full scale band is m_scale * ln(256) high, see update_kernel_params()
+    m_waterfall.Upload(history, 1.0f / (m_scale * logf(256.0f)));
+  }
+
+  CFrameProfiler::CTimer timer(m_profiler, ProfileStage::Draw);
+  CGpuStageTimer::CScope gpuTimer(m_gpuTimer, profiling, ProfileStage::GpuDraw);
+  if (m_paletteDirty)
+    update_palette();
+  glDisable(GL_BLEND);
+  m_waterfall.Draw(m_analyzer.Grids(), m_paletteTexture);
+  glEnable(GL_BLEND);
+  return true;
+}
+
 
 /**
  * GetInfo function of CVisualizationSpectrum class.
@@ -604,7 +2223,8 @@ void CVisualizationSpectrum::draw_all_bars(void)
  */ 
 void CVisualizationSpectrum::GetInfo(bool &wantsFreq, int &syncDelay)
 {
-  wantsFreq = true;
+  /* Kodi does not need to compute its FFT when we use ours. */
+  wantsFreq = !m_builtinFFTSetting;
   syncDelay = m_updateLag;
 }
 
@@ -612,9 +2232,12 @@ void CVisualizationSpectrum::GetInfo(bool &wantsFreq, int &syncDelay)
 /**
  * Implements the audio processing function.
  *
- * It performs a re-scaling of the number of "iFreqDataLength" FFT samples pointed by "pFreqData" to the NUM_BARS of bars.
+ * It performs a re-scaling of the number of "iFreqDataLength" FFT samples pointed by "pFreqData" to the number of bands,
+ * on a logarithmic frequency scale (see CBandMapper).
  * The "GetInfo()" member function needs to be be overriden with a function to return "true" for the "wantsFFT" out parameter.
  * Otherwise, "iFreqDataLength" is always zero, when this function is called.
+ * With the built-in FFT ("fft_source" setting), the FFT samples are computed here from the "iAudioDataLength" interleaved
+ * samples pointed by "pAudioData" instead, with a longer FFT for a finer resolution of the low frequencies.
  *
  * @param[in] pAudioData 
  * @param[in] iAudioDataLength 
@@ -623,55 +2246,56 @@ void CVisualizationSpectrum::GetInfo(bool &wantsFreq, int &syncDelay)
  */
 void CVisualizationSpectrum::AudioData(const float* pAudioData, int iAudioDataLength, float *pFreqData, int iFreqDataLength)
 {
-  int x, y, c;
-  int dividerOfFFTSamples;
-  float *pTempFreqData;
-  
-  /* Shift the old data by one row backwards, no matter what we are going to display. Since, you know: "Tempus fugit!" */
-  for (y = (NUM_BARS-1); y > 0; y--)
+  CFrameProfiler::CTimer timer(m_profiler, ProfileStage::AudioData);
+
+  /* Move the history one row backwards, no matter what we are going to display. Since, you know: "Tempus fugit!" */
+  /* Either way the new history is handed over to Render() without ever waiting for it. */
+  /* Rows are stamped with the stream time, counted in samples, Render() glides between them at that pace. */
+  if (iAudioDataLength > 0)
+    m_audioTime += static_cast<double>(iAudioDataLength / m_channels) / m_samplesPerSec;
+
+  /* With our own FFT, a call completes as many FFT frames as it contains hops, which can be none. */
+  if (m_builtinFFT)
   {
-    for (x = 0; x < NUM_BARS; x++)
+    if (iAudioDataLength > 0 && pAudioData != nullptr && m_analyzer.PushAudio(pAudioData, iAudioDataLength))
     {
-      m_heights[y][x] = m_heights[y - 1][x];
-    };
-  };
+      m_profiler.CountAllocations(ProfileStage::AudioData, 1); // The band table
+      const CBandMapper& mapper = m_analyzer.Mapper();
+      kodi::Log(ADDON_LOG_DEBUG, "iAudioDataLength=%d, built-in FFT of %u samples, %u bands from %.0f Hz to %.0f Hz",
+                iAudioDataLength, m_analyzer.Signal().Size(), mapper.BandCount(), mapper.LowFrequency(),
+                mapper.HighFrequency());
+    }
+    return;
+  }
+
+  /* Silent blocks (paused, between tracks) push a flat row, the FFT data is not even looked at. */
+  if (pAudioData != nullptr && iAudioDataLength > 0 &&
+      CSpectrumAnalyzer::MeanSquare(pAudioData, iAudioDataLength) < SILENCE_LEVEL)
+  {
+    m_analyzer.PushSilence(m_audioTime);
+    return;
+  }
 
-  /* If the number of FFT samples are less than the number of bars, we have a problem. */
-  if (iFreqDataLength < NUM_BARS)
+  /* Without FFT samples, we have a problem. */
+  if (iFreqDataLength <= 0 || pFreqData == nullptr)
   {
     /* No valid FFT data, bailing out! But first, populate the buffer with some stuff, just in case. */
-    for (x = 0; x < NUM_BARS; x++)
-      m_heights[y][x] = -1.0f;
-    
-    kodi::Log(ADDON_LOG_ERROR, "iFreqDataLength=%d but we expected a number greater than: %d", iFreqDataLength, NUM_BARS);
+    m_analyzer.PushSilence(m_audioTime);
+
+    kodi::Log(ADDON_LOG_ERROR, "iFreqDataLength=%d but we expected a number greater than zero", iFreqDataLength);
   }
   else
   {
     /* Fetch the FFT data and convert it to the bar height that we want to display by shifting the bars to produce a time series... */
-    
-    dividerOfFFTSamples = iFreqDataLength / NUM_BARS;
-    pTempFreqData = pFreqData;
-
-    /* Display some debug info, but only once... */
-    if (m_debugInfoAlreadyDisplayed == false)
-    {
-      kodi::Log(ADDON_LOG_DEBUG, "iAudioDataLength=%d, iFreqDataLength=%d, dividerOfFFTSamples=%d", iAudioDataLength, iFreqDataLength, dividerOfFFTSamples);
-      m_debugInfoAlreadyDisplayed = true;
-    };
-
-    /* Computate the new data to vizualize */
-    /* On my testing we get 256 FFT samples, that we want to show with 16 bars, therefore 16 FFT samples will be summed up into on bar's height. */
-    for (x = 0; x < NUM_BARS; x++)
+    /* On my testing we get 256 FFT samples, they are reduced into logarithmically spaced bands and scaled to bar heights in one pass. */
+    /* The band table only depends on the FFT length and the sample rate, it is rebuilt when one of them changes. */
+    if (m_analyzer.Push(pFreqData, iFreqDataLength, m_audioTime))
     {
-      m_heights[0][x] = 0.0f;
-      for (c = 0; c < dividerOfFFTSamples; c++)
-      {
-        m_heights[0][x] += *pTempFreqData;
-        pTempFreqData++;
-      };
-      //m_heights[0][x] = m_heights[0][x] / (float)dividerOfFFTSamples;
+      m_profiler.CountAllocations(ProfileStage::AudioData, 1); // The band table
+      const CBandMapper& mapper = m_analyzer.Mapper();
+      kodi::Log(ADDON_LOG_DEBUG, "iAudioDataLength=%d, iFreqDataLength=%d, %u bands from %.0f Hz to %.0f Hz",
+                iAudioDataLength, iFreqDataLength, mapper.BandCount(), mapper.LowFrequency(), mapper.HighFrequency());
     };
-    
   };  /*End of: if (iFreqDataLength <= 0)*/
 } /* End of the function: CVisualizationSpectrum::AudioData :) */
 
@@ -705,6 +2329,211 @@ void CVisualizationSpectrum::SetBarHeightSetting(int settingValue)
     m_scale = 0.5f / log(256.f);
     break;
   }
+
+  update_kernel_params();
+}
+
+void CVisualizationSpectrum::SetBandReductionSetting(int settingValue)
+{
+  switch (settingValue)
+  {
+  case 1:
+    m_kernelParams.reduction = BandReduction::Max;
+    break;
+  case 2:
+    m_kernelParams.reduction = BandReduction::Rms;
+    break;
+  case 0:
+  default:
+    m_kernelParams.reduction = BandReduction::Sum;
+    break;
+  }
+
+  m_analyzer.SetKernelParams(m_kernelParams);
+}
+
+void CVisualizationSpectrum::SetHeightScaleSetting(int settingValue)
+{
+  if ((settingValue >= 0) && (settingValue <= 2))
+    m_heightScale = settingValue;
+
+  update_kernel_params();
+}
+
+/**
+ * Tells whether this frame would look exactly like the last one.
+ *
+ * That is when the rotation is fixed and the history did not change for long enough for the
+ * smoothing and the glide between rows to settle: no new row (paused), or only rows like all the
+ * others (silence, see CSpectrumAnalyzer::TrackChanges()). Called only from Render().
+ */
+bool CVisualizationSpectrum::scene_is_still(const std::chrono::steady_clock::time_point& now)
+{
+  const CSpectrumHistory& history = m_analyzer.Snapshots().Front();
+  if (history.Pushes() != m_stillPushes)
+  {
+    m_stillPushes = history.Pushes();
+    if (history.SteadyRows() + 1 < history.Depth())
+      m_lastChange = now;
+  }
+
+  if (m_y_fixedAngle < 0.0f || m_x_speed != 0.0f || m_z_speed != 0.0f)
+    return false;
+
+  // exp(-8) of the last change is left, well below a pixel
+  const float settleTime = 8.0f * std::max(m_attackTime, m_releaseTime) + MAX_ROW_INTERVAL;
+  return std::chrono::duration<float>(now - m_lastChange).count() >= settleTime;
+}
+
+/**
+ * Writes the percentiles of every profiled stage to the debug log, every PROFILE_LOG_INTERVAL.
+ *
+ * Called only from Render(), when the "profiling" setting is on. The figures cover the last
+ * CFrameProfiler::RING_SIZE samples of each stage, the allocation counts the time since the last
+ * summary.
+ */
+void CVisualizationSpectrum::log_profile(void)
+{
+  const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if (std::chrono::duration<float>(now - m_profileLogTime).count() < PROFILE_LOG_INTERVAL)
+    return;
+  m_profileLogTime = now;
+
+  CFrameProfiler::Summary summary;
+  for (unsigned int i = 0; i < static_cast<unsigned int>(ProfileStage::Count); i++)
+  {
+    const ProfileStage stage = static_cast<ProfileStage>(i);
+    if (m_profiler.Summarize(stage, summary))
+      kodi::Log(ADDON_LOG_DEBUG, "Profile %-11s p50 %7.3f  p95 %7.3f  p99 %7.3f  max %7.3f ms, %u samples, %u allocations",
+                CFrameProfiler::StageName(stage), summary.p50, summary.p95, summary.p99, summary.max,
+                summary.samples, summary.allocations);
+  }
+}
+
+/**
+ * Writes to the log how long the first frame took from the constructor, and how much of it went
+ * into building the shader programs, with or without their cached binaries.
+ *
+ * Called only once, from the first Render() that draws.
+ */
+void CVisualizationSpectrum::log_first_frame(void)
+{
+  m_firstFrameDrawn = true;
+
+  const CGLProgram* programs[] =
+  {
+    this,
+    &m_frameCache,
+    &m_waterfall,
+#ifdef SPECTRUM_INSTANCING
+    &m_smoother,
+    &m_surface,
+#endif
+  };
+  unsigned int built = 0;
+  unsigned int cached = 0;
+  float buildTime = 0.0f;
+  for (const CGLProgram* program : programs)
+  {
+    if (!program->ShaderOK())
+      continue;
+    built++;
+    cached += program->FromCache() ? 1 : 0;
+    buildTime += program->LoadMilliseconds();
+  }
+
+  const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  kodi::Log(ADDON_LOG_INFO, "First frame %.1f ms after construction, %.1f ms of it building %u shader programs (%u from the cache)",
+            std::chrono::duration<float, std::milli>(now - m_constructionTime).count(), buildTime, built, cached);
+}
+
+/**
+ * Lays the bars out for the level picked by m_governor.
+ *
+ * Every part of a level only changes the draw calls: the band step is a uniform of the bar
+ * shaders, which place the bars themselves, so nothing is uploaded when the governor changes it.
+ * Called from Start() and Render().
+ */
+void CVisualizationSpectrum::apply_quality_level(void)
+{
+  const QualityLevel& level = m_governor.Current();
+  const CSpectrumHistory& history = m_analyzer.History();
+
+  m_qualityLevel = m_governor.Level();
+  m_drawnRows = std::max(1U, static_cast<unsigned int>(lroundf(history.Depth() * level.rows)));
+  m_allFaces = level.allFaces;
+  m_renderScale = level.renderScale;
+  m_bandStep = level.bandStep;
+  m_drawnBars = history.Bands() / m_bandStep * m_drawnRows;
+  m_frameCache.Invalidate();
+}
+
+/**
+ * Feeds the cost of this frame to m_governor, and writes its state to the debug log on every level
+ * change and every PROFILE_LOG_INTERVAL. The new level is applied on the next frame.
+ *
+ * Called only from Render(), at its very end. Frames drawn from m_frameCache are left out, they
+ * do not tell what the scene costs.
+ *
+ * @param[in] start When the frame started.
+ * @param[in] frameTime Time since the previous frame, in seconds.
+ */
+void CVisualizationSpectrum::adapt_quality(const std::chrono::steady_clock::time_point& start, float frameTime)
+{
+  if (!m_governor.IsEnabled())
+    return;
+
+  const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  const unsigned int previous = m_governor.Level();
+  const bool changed = m_governor.AddFrame(std::chrono::duration<float, std::milli>(now - start).count(), frameTime * 1000.0f);
+  if (!changed && std::chrono::duration<float>(now - m_qualityLogTime).count() < PROFILE_LOG_INTERVAL)
+    return;
+  m_qualityLogTime = now;
+
+  const QualityLevel& level = m_governor.Current();
+  const CQualityGovernor::Window& window = m_governor.LastWindow();
+  kodi::Log(ADDON_LOG_DEBUG, "Quality level %u (was %u), target %.1f ms: render p90 %.2f ms, frame p90 %.2f ms, "
+            "%u misses, %u of %u good windows; %.0f%% of the rows, band step %u, %s faces, render scale %.2f",
+            m_governor.Level(), previous, m_governor.Target(), window.renderP90, window.frameP90, window.misses,
+            window.goodWindows, window.upWindows, level.rows * 100.0f, level.bandStep, level.allFaces ? "all" : "reduced",
+            level.renderScale);
+}
+
+/**
+ * Folds the bar height (m_scale) and the height scale settings into the band kernel parameters.
+ *
+ * m_scale is k / ln(256), k being the height of a full scale band:
+ *  - linear:      k * value
+ *  - logarithmic: k * (1 + log256(value)), 1/256 and below are flat
+ *  - decibel:     k * (1 + dB(value) / 60), 60 dB of range
+ */
+void CVisualizationSpectrum::update_kernel_params(void)
+{
+  const float k = m_scale * logf(256.0f);
+
+  switch (m_heightScale)
+  {
+  case 1:
+    m_kernelParams.logarithmic = true;
+    m_kernelParams.gain = k / 8.0f;
+    m_kernelParams.offset = k;
+    break;
+
+  case 2:
+    m_kernelParams.logarithmic = true;
+    m_kernelParams.gain = k * 20.0f * log10f(2.0f) / 60.0f;
+    m_kernelParams.offset = k;
+    break;
+
+  case 0:
+  default:
+    m_kernelParams.logarithmic = false;
+    m_kernelParams.gain = k;
+    m_kernelParams.offset = 0.0f;
+    break;
+  }
+
+  m_analyzer.SetKernelParams(m_kernelParams);
 }
 
 
@@ -723,11 +2552,16 @@ void CVisualizationSpectrum::SetModeSetting(int settingValue)
       break;
 
     case 0:
+    case 3:
+    case 4:
     default:
       m_mode = GL_TRIANGLES;
       m_pointSize = 0.0f;
       break;
   }
+  // Without instancing (GLES 2.0), the surface mode draws the filled bars
+  m_surfaceMode = settingValue == 3;
+  m_waterfallMode = settingValue == 4;
 }
 
 void CVisualizationSpectrum::SetSpeedSetting(int settingValue)
@@ -744,44 +2578,141 @@ void CVisualizationSpectrum::SetBarColorSetting(int settingValue)
   // TBI add an upper limit (for peace of mind) to the validation, but at the moment we don't really know how many color schemes will be supported.
   if (settingValue >= 0)
     m_bar_color_type = settingValue;
+
+  // The palette texture is refilled on the next frame.
+  m_paletteDirty = true;
 }
 
 void CVisualizationSpectrum::SetRotationSpeedSetting(int settingValue)
 {
+  // In degrees per second, the former per frame steps at 60 fps.
   switch (settingValue)
   {
   case 4:
-    m_y_speed = 10.0f;
+    m_y_speed = 600.0f;
     break;
   case 3:
-    m_y_speed = 6.0f;
+    m_y_speed = 360.0f;
     break;
   case 2:
-    m_y_speed = 3.0f;
+    m_y_speed = 180.0f;
     break;
   case 1:
-    m_y_speed = 1.5f;
+    m_y_speed = 90.0f;
     break;
   case 0:
   default:
-    m_y_speed = 0.5f;
+    m_y_speed = 30.0f;
     break;
   case -1:
-    m_y_speed = 0.25f;
+    m_y_speed = 15.0f;
     break;
   case -2:
-    m_y_speed = 0.0625f;
+    m_y_speed = 3.75f;
     break;
   case -3:
-    m_y_speed = 0.03125f;
+    m_y_speed = 1.875f;
     break;
   case -4:
-    m_y_speed = 0.015625f;
+    m_y_speed = 0.9375f;
     break;
   };
 }
 
 
+void CVisualizationSpectrum::SetBandsSetting(int settingValue)
+{
+  /* The new grid size is applied on the next Start(), when the buffers are allocated. */
+  if (settingValue < (int)NUM_BARS)
+    m_bandsSetting = NUM_BARS;
+  else if (settingValue > (int)MAX_BANDS)
+    m_bandsSetting = MAX_BANDS;
+  else
+    m_bandsSetting = settingValue;
+}
+
+void CVisualizationSpectrum::SetAttackSetting(int settingValue)
+{
+  switch (settingValue)
+  {
+  case 1://fast
+    m_attackTime = 0.01f;
+    break;
+  case 2://medium
+    m_attackTime = 0.04f;
+    break;
+  case 3://slow
+    m_attackTime = 0.1f;
+    break;
+  case 0://off
+  default:
+    m_attackTime = 0.0f;
+    break;
+  }
+}
+
+void CVisualizationSpectrum::SetReleaseSetting(int settingValue)
+{
+  switch (settingValue)
+  {
+  case 1://fast
+    m_releaseTime = 0.1f;
+    break;
+  case 2://medium
+    m_releaseTime = 0.25f;
+    break;
+  case 3://slow
+    m_releaseTime = 0.6f;
+    break;
+  case 0://off
+  default:
+    m_releaseTime = 0.0f;
+    break;
+  }
+}
+
+void CVisualizationSpectrum::SetFFTSizeSetting(int settingValue)
+{
+  /* Like the grid size, the FFT length is applied on the next Start(). */
+  m_fftSizeSetting = MIN_FFT_SIZE;
+  while (settingValue-- > 0 && m_fftSizeSetting < MAX_FFT_SIZE)
+    m_fftSizeSetting *= 2;
+}
+
+void CVisualizationSpectrum::SetChannelLayoutSetting(int settingValue)
+{
+  /* Applied on the next Start() too, and only with the built-in FFT of a stereo stream. */
+  if (settingValue == 2)
+    m_channelLayoutSetting = SpectrumChannels::MidSide;
+  else if (settingValue == 1)
+    m_channelLayoutSetting = SpectrumChannels::LeftRight;
+  else
+    m_channelLayoutSetting = SpectrumChannels::Mono;
+}
+
+void CVisualizationSpectrum::SetAdaptiveQualitySetting(int settingValue)
+{
+  /* Picked up by the next frame, the governor starts again from the full quality. */
+  if (settingValue == 2)
+    m_qualityTargetSetting = 1000.0f / 30.0f;
+  else if (settingValue == 1)
+    m_qualityTargetSetting = 1000.0f / 60.0f;
+  else
+    m_qualityTargetSetting = 0.0f;
+}
+
+void CVisualizationSpectrum::SetHistoryDepthSetting(int settingValue)
+{
+  /* The new grid size is applied on the next Start(), when the buffers are allocated. */
+  if (settingValue < (int)NUM_BARS)
+    m_historyDepthSetting = NUM_BARS;
+  else if (settingValue > (int)MAX_HISTORY_DEPTH)
+    m_historyDepthSetting = MAX_HISTORY_DEPTH;
+  else
+    m_historyDepthSetting = settingValue;
+}
+
+
 /**
  * Brief description.
  *
@@ -796,11 +2727,34 @@ ADDON_STATUS CVisualizationSpectrum::SetSetting(const std::string& settingName,
   if (settingName.empty() || settingValue.empty())
     return ADDON_STATUS_UNKNOWN;
 
+  /* Most settings change the picture, a cached frame is not shown again after any of them. */
+  m_settingChanges.fetch_add(1, std::memory_order_relaxed);
+
   if (settingName == "bar_height")
   {
     SetBarHeightSetting(settingValue.GetInt());
     return ADDON_STATUS_OK;
   }
+  else if (settingName == "band_reduction")
+  {
+    SetBandReductionSetting(settingValue.GetInt());
+    return ADDON_STATUS_OK;
+  }
+  else if (settingName == "height_scale")
+  {
+    SetHeightScaleSetting(settingValue.GetInt());
+    return ADDON_STATUS_OK;
+  }
+  else if (settingName == "bar_attack")
+  {
+    SetAttackSetting(settingValue.GetInt());
+    return ADDON_STATUS_OK;
+  }
+  else if (settingName == "bar_release")
+  {
+    SetReleaseSetting(settingValue.GetInt());
+    return ADDON_STATUS_OK;
+  }
   else if (settingName == "speed")
   {
     SetSpeedSetting(settingValue.GetInt());
@@ -826,6 +2780,51 @@ ADDON_STATUS CVisualizationSpectrum::SetSetting(const std::string& settingName,
     SetRotationSpeedSetting(settingValue.GetInt());
     return ADDON_STATUS_OK;
   }
+  else if (settingName == "bands")
+  {
+    SetBandsSetting(settingValue.GetInt());
+    return ADDON_STATUS_OK;
+  }
+  else if (settingName == "history_depth")
+  {
+    SetHistoryDepthSetting(settingValue.GetInt());
+    return ADDON_STATUS_OK;
+  }
+  else if (settingName == "fft_source")
+  {
+    m_builtinFFTSetting = settingValue.GetInt() == 1;
+    return ADDON_STATUS_OK;
+  }
+  else if (settingName == "fft_size")
+  {
+    SetFFTSizeSetting(settingValue.GetInt());
+    return ADDON_STATUS_OK;
+  }
+  else if (settingName == "fft_window")
+  {
+    m_fftWindowSetting = settingValue.GetInt() == 1 ? SpectrumWindow::Blackman : SpectrumWindow::Hann;
+    return ADDON_STATUS_OK;
+  }
+  else if (settingName == "fft_overlap")
+  {
+    m_fftOverlapSetting = settingValue.GetInt() == 1 ? 0.75f : 0.5f;
+    return ADDON_STATUS_OK;
+  }
+  else if (settingName == "channel_layout")
+  {
+    SetChannelLayoutSetting(settingValue.GetInt());
+    return ADDON_STATUS_OK;
+  }
+  else if (settingName == "adaptive_quality")
+  {
+    SetAdaptiveQualitySetting(settingValue.GetInt());
+    return ADDON_STATUS_OK;
+  }
+  else if (settingName == "profiling")
+  {
+    m_profiler.SetEnabled(settingValue.GetInt() == 1);
+    return ADDON_STATUS_OK;
+  }
 
   return ADDON_STATUS_UNKNOWN;
 }
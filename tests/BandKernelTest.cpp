@@ -0,0 +1,135 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+/*
+ * Checks every SIMD band kernel this CPU supports against the scalar reference.
+ *
+ * For each reduction, in logarithmic and linear mode, over band counts and FFT lengths that are
+ * and are not multiples of the SIMD widths, the heights must stay within the bounds documented in
+ * BandKernel.h: MAX_LOG2_ERROR * |gain| in logarithmic mode, a relative MAX_SUM_ERROR in linear
+ * mode.
+ */
+
+#include "BandKernel.h"
+#include "BandMapper.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+
+const CBandKernel::Isa SIMD_ISAS[] = { CBandKernel::Isa::SSE2, CBandKernel::Isa::AVX2, CBandKernel::Isa::NEON };
+const BandReduction REDUCTIONS[] = { BandReduction::Sum, BandReduction::Max, BandReduction::Rms };
+const unsigned int BAND_COUNTS[] = { 1, 3, 4, 7, 8, 9, 15, 16, 17, 33, 64, 100, 128, 255, 256, 511, 512 };
+const unsigned int BIN_COUNTS[] = { 8, 13, 64, 257, 1023, 1024, 4097, 16384 };
+const unsigned int SAMPLE_RATES[] = { 44100, 8000 };
+
+const char* ReductionName(BandReduction reduction)
+{
+  switch (reduction)
+  {
+    case BandReduction::Max:
+      return "max";
+    case BandReduction::Rms:
+      return "rms";
+    default:
+      return "sum";
+  }
+}
+
+// FFT magnitudes over 24 octaves, with some zero bins, from a fixed seed
+std::vector<float> MakeBins(unsigned int count, uint32_t seed)
+{
+  std::vector<float> bins(count);
+  for (unsigned int i = 0; i < count; i++)
+  {
+    seed = seed * 1664525U + 1013904223U;
+    const float uniform = static_cast<float>(seed >> 8) / 16777216.0f;
+    bins[i] = i % 17 == 5 ? 0.0f : exp2f(uniform * 24.0f - 20.0f);
+  }
+  return bins;
+}
+
+} // namespace
+
+int main()
+{
+  const CBandKernel reference(CBandKernel::Isa::Scalar);
+  unsigned int cases = 0;
+  unsigned int failures = 0;
+  unsigned int testedIsas = 0;
+
+  for (CBandKernel::Isa isa : SIMD_ISAS)
+  {
+    if (!CBandKernel::IsSupported(isa))
+      continue;
+
+    testedIsas++;
+    const CBandKernel kernel(isa);
+    float worstLog = 0.0f; // Largest error seen, in units of the bound
+    float worstLinear = 0.0f;
+
+    for (unsigned int sampleRate : SAMPLE_RATES)
+    {
+      for (unsigned int bins : BIN_COUNTS)
+      {
+        const std::vector<float> freqData = MakeBins(bins, bins * 31U + sampleRate);
+        for (unsigned int bands : BAND_COUNTS)
+        {
+          CBandMapper mapper;
+          mapper.Configure(bands, bins, sampleRate);
+          std::vector<float> expected(bands);
+          std::vector<float> heights(bands);
+
+          for (BandReduction reduction : REDUCTIONS)
+          {
+            for (bool logarithmic : { true, false })
+            {
+              BandKernelParams params;
+              params.reduction = reduction;
+              params.logarithmic = logarithmic;
+              params.gain = logarithmic ? 0.0752575f : 2.5f; // 20 dB per decade over 80 dB
+              params.offset = logarithmic ? 1.0f : 0.0f;
+              reference.Process(mapper, freqData.data(), expected.data(), params);
+              kernel.Process(mapper, freqData.data(), heights.data(), params);
+              cases++;
+
+              for (unsigned int band = 0; band < bands; band++)
+              {
+                const float error = fabsf(heights[band] - expected[band]);
+                const float bound = logarithmic ? CBandKernel::MAX_LOG2_ERROR * fabsf(params.gain)
+                                                : CBandKernel::MAX_SUM_ERROR * fabsf(expected[band]);
+                float& worst = logarithmic ? worstLog : worstLinear;
+                if (bound > 0.0f)
+                  worst = fmaxf(worst, error / bound);
+                if (error > bound || heights[band] != heights[band])
+                {
+                  if (failures++ < 20)
+                    fprintf(stderr, "%s %s %s, %u bands, %u bins at %u Hz: band %u is %g, the reference %g\n",
+                            CBandKernel::IsaName(isa), ReductionName(reduction), logarithmic ? "log" : "linear",
+                            bands, bins, sampleRate, band, heights[band], expected[band]);
+                  break;
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+
+    printf("%s: worst error %.2f of the log bound, %.2f of the linear bound\n", CBandKernel::IsaName(isa), worstLog,
+           worstLinear);
+  }
+
+  if (testedIsas == 0)
+    printf("No SIMD band kernel on this CPU, nothing to compare\n");
+  printf("%u cases, %u failures\n", cases, failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,179 @@
+/*
+ *  Copyright (C) 2005-2020 Team Kodi (https://kodi.tv)
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *  See LICENSE.md for more information.
+ */
+
+/*
+ * Stress test of the history hand-over between the audio and the render thread.
+ *
+ * One thread pushes rows into a CSpectrumAnalyzer as fast as it can, each Push() publishing the
+ * history through the triple buffer, while another one takes the snapshots with Update(). Every
+ * row carries its push number as stream time, and its heights only depend on that number, so each
+ * snapshot taken is checked for:
+ *  - torn rows: heights that are not the ones of the row's push number,
+ *  - rows out of order: the times of consecutive rows must step down by exactly one,
+ *  - going back in time: a snapshot older than the one taken before it.
+ * Meant to be run under ThreadSanitizer too, see ENABLE_TSAN in CMakeLists.txt.
+ */
+
+#include "SpectrumAnalyzer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+const unsigned int BANDS = 64;
+const unsigned int DEPTH = 32;
+const unsigned int BINS = 512;
+const unsigned int PATTERNS = 13;      // Different rows, cycled through by the push numbers
+const unsigned int SILENCE_PERIOD = 7; // Every that many pushes, a silent row
+const unsigned int YIELD_PERIOD = 16;
+
+// Bins of a push number, the same value in all of them
+float BinValue(unsigned int push)
+{
+  return 1.0f + static_cast<float>(push % PATTERNS);
+}
+
+class CExpectedRows
+{
+public:
+  // Computes every row pattern once, with an analyzer of the same configuration
+  CExpectedRows()
+  {
+    CSpectrumAnalyzer analyzer;
+    analyzer.Configure(BANDS, DEPTH, 0);
+    std::vector<float> bins(BINS);
+    m_rows.resize(PATTERNS * BANDS);
+    for (unsigned int pattern = 0; pattern < PATTERNS; pattern++)
+    {
+      std::fill(bins.begin(), bins.end(), BinValue(pattern));
+      analyzer.Push(bins.data(), BINS, 0.0);
+      memcpy(&m_rows[pattern * BANDS], analyzer.History().Row(0), BANDS * sizeof(float));
+    }
+    m_silence.assign(BANDS, 0.0f);
+  }
+
+  const float* Row(unsigned int push) const
+  {
+    if (push % SILENCE_PERIOD == 0)
+      return m_silence.data();
+    return &m_rows[(push % PATTERNS) * BANDS];
+  }
+
+private:
+  std::vector<float> m_rows;
+  std::vector<float> m_silence;
+};
+
+struct Stats
+{
+  unsigned int snapshots = 0;
+  unsigned int rowsChecked = 0;
+  unsigned int failures = 0;
+};
+
+bool Fail(Stats& stats, const char* format, unsigned int a, unsigned int b)
+{
+  if (stats.failures++ < 10)
+  {
+    fprintf(stderr, format, a, b);
+    fputc('\n', stderr);
+  }
+  return false;
+}
+
+// Checks one snapshot against the one taken before it
+bool CheckSnapshot(const CSpectrumHistory& history, const CExpectedRows& expected, unsigned int& lastPushes, Stats& stats)
+{
+  const unsigned int pushes = history.Pushes();
+  if (pushes < lastPushes)
+    return Fail(stats, "Snapshot of push %u taken after the one of push %u", pushes, lastPushes);
+  lastPushes = pushes;
+  if (history.Bands() != BANDS || history.Depth() != DEPTH)
+    return Fail(stats, "Snapshot of %u x %u rows", history.Bands(), history.Depth());
+  if (pushes > 0 && history.Time(0) != static_cast<double>(pushes))
+    return Fail(stats, "Newest row of push %u in the snapshot of push %u", static_cast<unsigned int>(history.Time(0)), pushes);
+
+  const unsigned int rows = std::min(pushes, DEPTH);
+  for (unsigned int age = 0; age < rows; age++)
+  {
+    const unsigned int push = pushes - age;
+    if (history.Time(age) != static_cast<double>(push))
+      return Fail(stats, "Row %u holds push %u", age, static_cast<unsigned int>(history.Time(age)));
+    if (memcmp(history.Row(age), expected.Row(push), BANDS * sizeof(float)) != 0)
+      return Fail(stats, "Row %u of the snapshot of push %u is torn", age, pushes);
+    stats.rowsChecked++;
+  }
+  stats.snapshots++;
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  const unsigned int pushes = argc > 1 ? static_cast<unsigned int>(atoi(argv[1])) : 200000;
+  if (pushes == 0)
+  {
+    fprintf(stderr, "Usage: %s [pushes]\n", argv[0]);
+    return 1;
+  }
+
+  const CExpectedRows expected;
+  CSpectrumAnalyzer analyzer;
+  analyzer.Configure(BANDS, DEPTH, 0);
+
+  std::atomic<bool> done{false};
+  std::thread producer([&]() {
+    std::vector<float> bins(BINS);
+    for (unsigned int push = 1; push <= pushes; push++)
+    {
+      if (push % SILENCE_PERIOD == 0)
+      {
+        analyzer.PushSilence(push);
+      }
+      else
+      {
+        std::fill(bins.begin(), bins.end(), BinValue(push));
+        analyzer.Push(bins.data(), BINS, push);
+      }
+      // Lets the consumer in now and then, even on a single core
+      if (push % YIELD_PERIOD == 0)
+        std::this_thread::yield();
+    }
+    done.store(true, std::memory_order_release);
+  });
+
+  Stats stats;
+  unsigned int lastPushes = 0;
+  CTripleBuffer<CSpectrumHistory>& snapshots = analyzer.Snapshots();
+  for (;;)
+  {
+    // Read before Update(), so the last snapshot is taken after the last Publish()
+    const bool finished = done.load(std::memory_order_acquire);
+    if (snapshots.Update())
+      CheckSnapshot(snapshots.Front(), expected, lastPushes, stats);
+    else if (!finished)
+      std::this_thread::yield();
+    if (finished)
+      break;
+  }
+  producer.join();
+
+  if (lastPushes != pushes)
+    Fail(stats, "Last snapshot of push %u out of %u", lastPushes, pushes);
+
+  printf("%u pushes, %u snapshots, %u rows checked, %u failures\n", pushes, stats.snapshots, stats.rowsChecked,
+         stats.failures);
+  return stats.failures == 0 ? 0 : 1;
+}
@@ -1,18 +1,20 @@
 #version 150
 
-uniform float u_pointSize;
-
-in vec4 v_color;
+in vec2 paletteCoord;
+in float fragmentShade;
 
 out vec4 FragColor;
 
+uniform float u_pointSize;
+uniform sampler2D u_palette;
+
 void main()
 {
-  if (u_pointSize != 0.0)
+  if (u_pointSize > 1.0)
   {
-    vec2 coord = gl_PointCoord - vec2(0.5);  //from [0,1] to [-0.5,0.5]
-    if(length(coord) > 0.5)                  //outside of circle radius?
+    vec2 coord = gl_PointCoord - vec2(0.5);
+    if (length(coord) > 0.5)
       discard;
   }
-  FragColor = v_color;
+  FragColor = vec4(texture(u_palette, paletteCoord).rgb * fragmentShade, 1.0);
 }
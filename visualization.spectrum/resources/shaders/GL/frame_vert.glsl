@@ -0,0 +1,12 @@
+#version 150
+
+// Quad covering the viewport, in normalized device coordinates
+in vec2 a_position;
+
+out vec2 textureCoord;
+
+void main()
+{
+  textureCoord = a_position * 0.5 + 0.5;
+  gl_Position = vec4(a_position, 0.0, 1.0);
+}
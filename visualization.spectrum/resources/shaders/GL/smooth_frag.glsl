@@ -0,0 +1,29 @@
+#version 150
+
+out vec4 FragColor;
+
+// Target heights: the spectrum history ring, logical row "n" is stored at (n + u_historyHead) % u_historyDepth
+uniform sampler2D u_history;
+uniform int u_historyHead;
+uniform int u_historyDepth;
+
+// Heights shown by the last frame, one texel per bar, row 0 being the newest one
+uniform sampler2D u_shown;
+
+// Part of the way to the target covered by this frame, when rising and when falling
+uniform float u_attackMix;
+uniform float u_releaseMix;
+
+// Weight of each target row against the older one, the bars glide between the two newest spectra
+uniform float u_rowBlend;
+
+void main()
+{
+  ivec2 bar = ivec2(gl_FragCoord.xy);
+  int row = (bar.y + u_historyHead) % u_historyDepth;
+  float target = texelFetch(u_history, ivec2(bar.x, row), 0).r;
+  if (u_rowBlend < 1.0 && bar.y + 1 < u_historyDepth)
+    target = mix(texelFetch(u_history, ivec2(bar.x, (row + 1) % u_historyDepth), 0).r, target, u_rowBlend);
+  float shown = texelFetch(u_shown, bar, 0).r;
+  FragColor = vec4(mix(shown, target, target > shown ? u_attackMix : u_releaseMix), 0.0, 0.0, 1.0);
+}
@@ -0,0 +1,8 @@
+#version 150
+
+// Quad covering the viewport, drawn as a 4 vertex triangle strip without any vertex data
+void main()
+{
+  vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+  gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,70 @@
+#version 150
+
+// Vertex of the surface grid: band and age (0 being the newest row) of the height it shows
+in vec2 a_cell;
+
+out vec2 paletteCoord;
+out float fragmentShade;
+
+uniform mat4 u_projectionMatrix;
+uniform mat4 u_modelViewMatrix;
+
+// Heights, the same ring the bars read: logical row "n" is stored at (n + u_historyHead) % u_historyDepth
+uniform sampler2D u_history;
+uniform int u_historyHead;
+uniform int u_historyDepth;
+uniform int u_bands;
+
+// Bands of one grid, u_bands / 2 with the stereo grids, whose first one is mirrored
+uniform int u_gridBands;
+
+// Weight of each row against the older one, the surface glides between the two newest spectra
+uniform float u_rowBlend;
+
+// Size of the square covered by the grid, GRID_SIZE
+uniform float u_gridSize;
+
+// Texels of the bar palette in each direction, BAR_PALETTE_SIZE
+const float PALETTE_SIZE = 16.0;
+
+// Direction of the light, in grid space: from above, slightly to the right and front
+const vec3 LIGHT = vec3(0.36, 0.8, 0.48);
+
+float heightAt(int band, int age)
+{
+  band = clamp(band, 0, u_bands - 1);
+  age = clamp(age, 0, u_historyDepth - 1);
+  int row = (age + u_historyHead) % u_historyDepth;
+  float height = texelFetch(u_history, ivec2(band, row), 0).r;
+  if (u_rowBlend < 1.0 && age + 1 < u_historyDepth)
+    height = mix(texelFetch(u_history, ivec2(band, (row + 1) % u_historyDepth), 0).r, height, u_rowBlend);
+  return max(height, 0.0);
+}
+
+void main()
+{
+  int band = int(a_cell.x);
+  int age = int(a_cell.y);
+  vec2 spacing = vec2(u_gridSize / float(u_bands), u_gridSize / float(u_historyDepth));
+
+  // Over the center of the bar the other modes draw there
+  float height = heightAt(band, age);
+  vec3 position = vec3(-u_gridSize / 2.0 + (float(band) + 0.25) * spacing.x,
+                       height,
+                       -u_gridSize / 2.0 + (float(u_historyDepth - age) + 0.25) * spacing.y);
+
+  // Central differences, older rows are further away along -z
+  float slopeX = (heightAt(band + 1, age) - heightAt(band - 1, age)) / (2.0 * spacing.x);
+  float slopeZ = (heightAt(band, age - 1) - heightAt(band, age + 1)) / (2.0 * spacing.y);
+  vec3 normal = normalize(vec3(-slopeX, 1.0, -slopeZ));
+
+  int grid = band / u_gridBands;
+  int gridBand = band - grid * u_gridBands;
+  if (grid == 0 && u_gridBands < u_bands)
+    gridBand = u_gridBands - 1 - gridBand;
+
+  gl_Position = u_projectionMatrix * u_modelViewMatrix * vec4(position, 1.0);
+  // Between the centers of the first and the last palette texel, see BarPaletteCoord()
+  paletteCoord = (0.5 + vec2(float(gridBand) / float(u_gridBands), float(age) / float(u_historyDepth)) * (PALETTE_SIZE - 1.0)) / PALETTE_SIZE;
+  fragmentShade = 0.3 + 0.7 * max(dot(normal, normalize(LIGHT)), 0.0);
+}
@@ -1,17 +1,64 @@
 #version 150
 
+// Per-vertex data of the unit bar mesh, there is no per-instance data: the instance ID is
+// "row * (u_bands / u_bandStep) + band / u_bandStep"
+in vec3 a_position;
+in float a_shade;
+
+out vec2 paletteCoord;
+out float fragmentShade;
+
 uniform mat4 u_projectionMatrix;
 uniform mat4 u_modelViewMatrix;
 uniform float u_pointSize;
+// Bar size, then the distance between two neighbouring bands and rows
+uniform vec2 u_barSize;
+uniform vec2 u_gridSpacing;
+uniform float u_shadeMix;
+
+// Spectrum history ring: one row per update, logical row "n" is stored at (n + u_historyHead) % u_historyDepth
+uniform sampler2D u_history;
+uniform int u_historyHead;
+uniform int u_historyDepth;
+uniform int u_bands;
+
+// Every u_bandStep-th band is drawn, see CQualityGovernor
+uniform int u_bandStep;
 
-in vec4 a_position;
-in vec4 a_color;
+// Bands of one grid, u_bands / 2 with the stereo grids, whose first one is mirrored
+uniform int u_gridBands;
 
-out vec4 v_color;
+// Texels of the bar palette in each direction, BAR_PALETTE_SIZE
+const float PALETTE_SIZE = 16.0;
 
-void main ()
+// Weight of each row against the older one, the bars glide between the two newest spectra
+uniform float u_rowBlend;
+
+void main()
 {
-  gl_Position = u_projectionMatrix * u_modelViewMatrix * a_position;
+  int drawnBands = u_bands / u_bandStep;
+  int band = gl_InstanceID % drawnBands * u_bandStep;
+  int age = gl_InstanceID / drawnBands;
+  int row = (age + u_historyHead) % u_historyDepth;
+  float height = texelFetch(u_history, ivec2(band, row), 0).r;
+  if (u_rowBlend < 1.0 && age + 1 < u_historyDepth)
+    height = mix(texelFetch(u_history, ivec2(band, (row + 1) % u_historyDepth), 0).r, height, u_rowBlend);
+  // A negative height would flip the bar below the floor, where it is culled
+  height = max(height, 0.0);
+
+  int grid = band / u_gridBands;
+  int gridBand = band - grid * u_gridBands;
+  if (grid == 0 && u_gridBands < u_bands)
+    gridBand = u_gridBands - 1 - gridBand;
+
+  vec2 offset = vec2(float(band) - 0.5 * float(u_bands), 0.5 * float(u_historyDepth) - float(age)) * u_gridSpacing;
+  vec3 position = vec3(offset.x + a_position.x * u_barSize.x,
+                       a_position.y * height,
+                       offset.y + a_position.z * u_barSize.y);
+
+  gl_Position = u_projectionMatrix * u_modelViewMatrix * vec4(position, 1.0);
   gl_PointSize = u_pointSize;
-  v_color = a_color;
+  // Between the centers of the first and the last palette texel, see BarPaletteCoord()
+  paletteCoord = (0.5 + vec2(float(gridBand) / float(u_gridBands), float(age) / float(u_historyDepth)) * (PALETTE_SIZE - 1.0)) / PALETTE_SIZE;
+  fragmentShade = mix(1.0, a_shade, u_shadeMix);
 }
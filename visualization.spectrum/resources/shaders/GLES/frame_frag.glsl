@@ -0,0 +1,15 @@
+#version 300 es
+
+precision mediump float;
+
+in vec2 textureCoord;
+
+out vec4 FragColor;
+
+// Copy of the viewport as the last frame left it
+uniform sampler2D u_frame;
+
+void main()
+{
+  FragColor = vec4(texture(u_frame, textureCoord).rgb, 1.0);
+}
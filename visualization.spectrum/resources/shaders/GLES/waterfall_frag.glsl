@@ -0,0 +1,33 @@
+#version 300 es
+
+precision mediump float;
+
+// Up to twice the ring, mediump would be off by a row of a deep history
+in highp vec2 historyCoord;
+in vec2 gridCoord;
+
+out vec4 FragColor;
+
+// Spectrum history ring, one 8-bit row per update, repeated along T so it wraps around
+uniform sampler2D u_history;
+
+// 2 with the stereo grids, side by side, the first one mirrored
+uniform float u_grids;
+
+// Colors of the bars, see BuildBarPalette()
+uniform sampler2D u_palette;
+
+// Texels of the bar palette in each direction, BAR_PALETTE_SIZE
+const float PALETTE_SIZE = 16.0;
+
+void main()
+{
+  float intensity = texture(u_history, historyCoord).r;
+
+  float gridBand = fract(gridCoord.x * u_grids);
+  if (u_grids > 1.0 && gridCoord.x < 0.5)
+    gridBand = 1.0 - gridBand;
+  vec2 paletteCoord = (0.5 + vec2(gridBand, gridCoord.y) * (PALETTE_SIZE - 1.0)) / PALETTE_SIZE;
+
+  FragColor = vec4(texture(u_palette, paletteCoord).rgb * intensity, 1.0);
+}
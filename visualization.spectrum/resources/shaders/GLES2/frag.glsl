@@ -0,0 +1,20 @@
+#version 100
+
+precision mediump float;
+
+varying vec2 paletteCoord;
+varying float fragmentShade;
+
+uniform float u_pointSize;
+uniform sampler2D u_palette;
+
+void main()
+{
+  if (u_pointSize > 1.0)
+  {
+    vec2 coord = gl_PointCoord - vec2(0.5);
+    if (length(coord) > 0.5)
+      discard;
+  }
+  gl_FragColor = vec4(texture2D(u_palette, paletteCoord).rgb * fragmentShade, 1.0);
+}
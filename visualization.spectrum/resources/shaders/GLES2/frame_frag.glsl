@@ -0,0 +1,13 @@
+#version 100
+
+precision mediump float;
+
+varying vec2 textureCoord;
+
+// Copy of the viewport as the last frame left it
+uniform sampler2D u_frame;
+
+void main()
+{
+  gl_FragColor = vec4(texture2D(u_frame, textureCoord).rgb, 1.0);
+}
@@ -0,0 +1,12 @@
+#version 100
+
+// Quad covering the viewport, in normalized device coordinates
+attribute vec2 a_position;
+
+varying vec2 textureCoord;
+
+void main()
+{
+  textureCoord = a_position * 0.5 + 0.5;
+  gl_Position = vec4(a_position, 0.0, 1.0);
+}
@@ -0,0 +1,64 @@
+#version 100
+
+// Static batch mesh: the unit bar mesh, once per bar of a draw call
+attribute vec3 a_position;
+attribute float a_shade;
+// Index of the bar in its draw call, and in u_heights
+attribute float a_bar;
+
+varying vec2 paletteCoord;
+varying float fragmentShade;
+
+uniform mat4 u_projectionMatrix;
+uniform mat4 u_modelViewMatrix;
+uniform mediump float u_pointSize;
+uniform float u_shadeMix;
+
+// Size of the grid, the bands of each of the grids side by side, and every how many bands a bar
+// is drawn
+uniform int u_bands;
+uniform int u_historyDepth;
+uniform int u_gridBands;
+uniform int u_bandStep;
+
+// Bar size, then the distance between two neighbouring bands and rows
+uniform vec2 u_barSize;
+uniform vec2 u_gridSpacing;
+
+// Index in the grid of the first bar of this draw call, the newest row first
+uniform float u_batchFirst;
+
+// Heights of the bars of this draw call, 4 per vector
+uniform vec4 u_heights[64];
+
+// Texels of the bar palette in each direction, BAR_PALETTE_SIZE
+const float PALETTE_SIZE = 16.0;
+
+void main()
+{
+  // The drawn bars are every u_bandStep-th band of every row, floats hold their indices exactly
+  float bands = float(u_bands);
+  float depth = float(u_historyDepth);
+  float gridBands = float(u_gridBands);
+  float drawnBands = float(u_bands / u_bandStep);
+  float bar = u_batchFirst + a_bar;
+  float age = floor((bar + 0.5) / drawnBands);
+  float band = (bar - age * drawnBands) * float(u_bandStep);
+
+  int index = int(a_bar + 0.5);
+  int vector = index / 4;
+  vec4 lane = vec4(equal(ivec4(index - vector * 4), ivec4(0, 1, 2, 3)));
+  // A negative height would flip the bar below the floor, where it is culled
+  float height = max(dot(u_heights[vector], lane), 0.0);
+
+  vec2 offset = vec2(band - 0.5 * bands, 0.5 * depth - age) * u_gridSpacing;
+  gl_Position = u_projectionMatrix * u_modelViewMatrix * vec4(offset.x + a_position.x * u_barSize.x,
+                                                              a_position.y * height,
+                                                              offset.y + a_position.z * u_barSize.y, 1.0);
+  gl_PointSize = u_pointSize;
+
+  // The colors follow the frequency, the first of two stereo grids is mirrored, see BarPaletteCoord()
+  float gridBand = band < gridBands ? (gridBands < bands ? gridBands - 1.0 - band : band) : band - gridBands;
+  paletteCoord = (0.5 + vec2(gridBand / gridBands, age / depth) * (PALETTE_SIZE - 1.0)) / PALETTE_SIZE;
+  fragmentShade = mix(1.0, a_shade, u_shadeMix);
+}
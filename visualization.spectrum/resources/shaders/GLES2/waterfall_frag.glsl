@@ -0,0 +1,31 @@
+#version 100
+
+precision mediump float;
+
+varying vec2 historyCoord;
+varying vec2 gridCoord;
+
+// Spectrum history ring, one 8-bit row per update, repeated along T so it wraps around, or not
+// filtered at all where GLES 2.0 cannot repeat it, see CWaterfall::Create()
+uniform sampler2D u_history;
+
+// 2 with the stereo grids, side by side, the first one mirrored
+uniform float u_grids;
+
+// Colors of the bars, see BuildBarPalette()
+uniform sampler2D u_palette;
+
+// Texels of the bar palette in each direction, BAR_PALETTE_SIZE
+const float PALETTE_SIZE = 16.0;
+
+void main()
+{
+  float intensity = texture2D(u_history, vec2(historyCoord.x, fract(historyCoord.y))).r;
+
+  float gridBand = fract(gridCoord.x * u_grids);
+  if (u_grids > 1.0 && gridCoord.x < 0.5)
+    gridBand = 1.0 - gridBand;
+  vec2 paletteCoord = (0.5 + vec2(gridBand, gridCoord.y) * (PALETTE_SIZE - 1.0)) / PALETTE_SIZE;
+
+  gl_FragColor = vec4(texture2D(u_palette, paletteCoord).rgb * intensity, 1.0);
+}
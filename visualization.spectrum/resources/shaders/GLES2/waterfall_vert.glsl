@@ -0,0 +1,23 @@
+#version 100
+
+// Quad covering the viewport, in normalized device coordinates
+attribute vec2 a_position;
+
+// Band along X, row along Y of the history ring, past its end towards the bottom of the viewport
+varying vec2 historyCoord;
+// Band along X, age along Y, both from 0 to 1
+varying vec2 gridCoord;
+
+// Spectrum history ring, logical row "n" is stored at (n + u_historyHead) % u_historyDepth
+uniform float u_historyHead;
+uniform float u_historyDepth;
+
+void main()
+{
+  // The newest row at the top, down to the oldest one at the bottom, between the texel centers so
+  // the newest and the oldest rows are not filtered together
+  float age = (0.5 - a_position.y * 0.5) * (u_historyDepth - 1.0);
+  historyCoord = vec2(a_position.x * 0.5 + 0.5, (u_historyHead + 0.5 + age) / u_historyDepth);
+  gridCoord = vec2(historyCoord.x, age / u_historyDepth);
+  gl_Position = vec4(a_position, 0.0, 1.0);
+}